@@ -28,6 +28,9 @@
 #define Vwmed  vwmed->self
 #define Vtach  vtach->self
 
+/* the socket of the daemon that hosts the --mux sessions, in the sockets directory */
+#define V_DAEMON_SOCKNAME ".vtachd"
+
 #define V_NUM_OBJECTS NUM_OBJECTS + 2
 #define E_OBJECT V_NUM_OBJECTS - 2
 #define I_OBJECT V_NUM_OBJECTS - 1
@@ -68,6 +71,10 @@ static const char usage[] =
   "        --send          send data to the specified socket from standard input\n"
   "        --exit          create the socket, fork and then exit\n"
   "        --remove-socket remove socket if exists and can not be connected\n"
+  "        --mux           host the --as= session in a shared daemon\n"
+  "        --list          list the sessions of the shared daemon\n"
+  "        --pool=         keep that many shells started ahead, for new frames\n"
+  "        --snapshot=     restore the windows from file, and save them there at quit\n"
   "        --loadfile=     load file for evaluation\n"
   "\n";
 
@@ -415,6 +422,20 @@ private int v_rline_cb (vwmed_t *vwmed, rline_t *rl, vwm_t *vwm, vwm_win *win, v
 
     retval = self(save_image, fname);
 
+    goto theend;
+  } else if (Cstring.eq (com->bytes, "@save_snapshot")) {
+    string_t *fn_arg = Rline.get.anytype_arg (rl, "as");
+    char *fname = (NULL is fn_arg ? $my(opts)->snapshot : fn_arg->bytes);
+
+    if (NULL is fname) {
+      retval = NOTOK;
+      goto theend;
+    }
+
+    string_t *log_arg = Rline.get.anytype_arg (rl, "log");
+    int flags = (NULL isnot log_arg and atoi (log_arg->bytes) ? VWM_SNAPSHOT_LOG : 0);
+    retval = Vwm.save_snapshot (vwm, fname, flags);
+
     goto theend;
   } else if (Cstring.eq (com->bytes, "`chdir")) {
     Vstring_t *dir = Rline.get.arg_fnames (rl, 1);
@@ -441,6 +462,10 @@ private void v_rline_command_cbs (ed_t *ed) {
   Ed.append.rline_command (ed, "@save_image", 0, 0);
   Ed.append.command_arg   (ed, "@save_image", "--as=", 5);
 
+  Ed.append.rline_command (ed, "@save_snapshot", 0, 0);
+  Ed.append.command_arg   (ed, "@save_snapshot", "--as=", 5);
+  Ed.append.command_arg   (ed, "@save_snapshot", "--log=", 6);
+
   Ed.append.rline_command (ed, "`chdir", 1, RL_ARG_FILENAME);
 }
 
@@ -754,7 +779,8 @@ private ival_t i_v_new_win (i_t *__i, v_t *this, int num_frames, int max_frames)
     .num_rows = rows,
     .num_cols = cols,
     .num_frames = num_frames,
-    .max_frames = max_frames));
+    .max_frames = max_frames,
+    .lazy = 1));
 
   return (ival_t) win;
 }
@@ -886,6 +912,63 @@ private int v_loadfile (v_t *this, char *fn) {
   return retval;
 }
 
+/* All the --mux sessions of a user live in one daemon, that is started by
+** the first one. Sessions are looked up by name through the daemon, so
+** there is no need to look into the sockets directory. */
+private int v_mux_main (v_t *this, char *as, int argc, char **argv,
+                                VExecChild vexec_child, VPtyMain vpty_main) {
+  vtach_t *vtach = $my(objects)[VTACH_OBJECT];
+  v_opts *opts = $my(opts);
+
+  if (0 is opts->list and NULL is as) {
+    fprintf (stderr, "--mux requires a session name with --as=\n");
+    return 1;
+  }
+
+  $my(as_sockname) = v_make_sockname (this, NULL, V_DAEMON_SOCKNAME);
+  if (NULL is $my(as_sockname))
+    return 1;
+
+  char *sockname = $my(as_sockname)->bytes;
+
+  if (NOTOK is Vtach.init.pty (vtach, sockname))
+    return 1;
+
+  if (opts->list)
+    return (OK is Vtach.daemon.list (vtach, stdout) ? 0 : 1);
+
+  if (0 is isatty (fileno (stdin))) {
+    fprintf (stderr, "Not a controlled terminal\n");
+    return 1;
+  }
+
+  int fd = Vtach.sock.connect (vtach, sockname);
+  if (NOTOK is fd) {
+    if (File.exists (sockname)) {
+      ifnot (File.is_sock (sockname)) {
+        fprintf (stderr, "%s: is not a socket\n", sockname);
+        return 1;
+      }
+
+      unlink (sockname);
+    }
+
+    vwmed_t *vwmed = $my(objects)[VWMED_OBJECT];
+    Vwmed.init.ved (vwmed);
+
+    Vtach.set.object (vtach, vwmed, VWMED_OBJECT);
+    Vtach.set.exec_child_cb (vtach, vexec_child);
+    Vtach.set.pty_main_cb (vtach, vpty_main);
+
+    if (NOTOK is Vtach.daemon.main (vtach))
+      return 1;
+  } else
+    close (fd);
+
+  Vtach.set.session (vtach, as, argc, argv);
+  return Vtach.tty.main (vtach);
+}
+
 private int v_main (v_t *this) {
   vtach_t *vtach = $my(objects)[VTACH_OBJECT];
 
@@ -894,6 +977,7 @@ private int v_main (v_t *this) {
   int argc = opts->argc;
   char *sockname = opts->sockname;
   char *loadfile = opts->loadfile;
+  char *snapshot = opts->snapshot;
   char **argv = opts->argv;
   char *as = opts->as;
   char *data = opts->data;
@@ -912,6 +996,10 @@ private int v_main (v_t *this) {
       OPT_BOOLEAN(0, "send", &opts->send_data, "send data to the specified socket", NULL, 0, 0),
       OPT_BOOLEAN(0, "exit", &opts->exit, "create the socket, fork and then exit", NULL, 0, 0),
       OPT_BOOLEAN(0, "remove-socket", &opts->remove_socket, "remove socket if exists and can not be connected", NULL, 0, 0),
+      OPT_BOOLEAN(0, "mux", &opts->mux, "host the --as= session in a shared daemon", NULL, 0, 0),
+      OPT_BOOLEAN(0, "list", &opts->list, "list the sessions of the shared daemon", NULL, 0, 0),
+      OPT_INTEGER(0, "pool", &opts->pool, "keep that many shells started ahead, for new frames", NULL, 0, 0),
+      OPT_STRING(0, "snapshot", &snapshot, "restore the windows from file, and save them there at quit", NULL, 0, 0),
       OPT_END()
     };
 
@@ -922,9 +1010,22 @@ private int v_main (v_t *this) {
 
   if (argc is -1) return 0;
 
+  if (opts->pool) {
+    vwm_t *vwm = $my(objects)[VWM_OBJECT];
+    Vwm.set.pool (vwm, opts->pool);
+  }
+
+  ifnot (NULL is snapshot) {
+    opts->snapshot = snapshot;
+    Vtach.set.snapshot (vtach, snapshot);
+  }
+
   ifnot (NULL is loadfile)
     return v_loadfile (this, loadfile);
 
+  if (opts->mux or opts->list)
+    return v_mux_main (this, as, argc, argv, vexec_child, vpty_main);
+
   if (NULL is sockname) {
     if (NULL is as) {
       fprintf (stderr, "required socket name hasn't been specified\n");
@@ -14,12 +14,16 @@ typedef struct v_init_opts {
     *data,
     *loadfile,
     *sockname,
+    *snapshot,
     **argv;
 
   int
     argc,
     exit,
     force,
+    mux,
+    list,
+    pool,
     attach,
     send_data,
     parse_argv,
@@ -36,10 +40,14 @@ typedef struct v_init_opts {
   .data = NULL,            \
   .loadfile = NULL,        \
   .sockname = NULL,        \
+  .snapshot = NULL,        \
   .argv = NULL,            \
   .argc = 0,               \
   .exit = 0,               \
   .force = 0,              \
+  .mux = 0,                \
+  .list = 0,               \
+  .pool = 0,               \
   .attach = 0,             \
   .send_data = 0,          \
   .parse_argv = 1,         \
@@ -1,7 +1,8 @@
-#define _POSIX_C_SOURCE 200809L
-#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
 
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -10,15 +11,25 @@
 #include <errno.h>
 
 #include <string.h>
+#include <stddef.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <time.h>
 #include <pty.h>
 #include <termios.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <linux/memfd.h>
 
 #include <libv/libvwm.h>
 #include <libv/libvtach.h>
@@ -34,6 +45,28 @@
 
 #define SOCKET_MAX_DATA_SIZE (sizeof (struct winsize))
 
+#define PTY_MAX_EVENTS   64
+/* Pending output per client, before we stop reading from the pty. */
+#define CLIENT_MAX_QUEUE (1 << 20)
+/* How long, in ms, the integrated renderer waits for a slow client,
+** before it drops it. */
+#define CLIENT_MAX_STALL 1000
+/* Input that waits for the program, before we stop reading its clients. */
+#define SESSION_MAX_INPUT (1 << 16)
+/* Largest MSG_OPEN payload (session name and argv) accepted by a daemon. */
+#define OPEN_MAX_PAYLOAD (1 << 16)
+/* Size of the shared memory ring of a client (a power of two). */
+#define SHM_RING_SIZE    (1 << 20)
+/* How much is moved with one splice() call. */
+#define SPLICE_LEN       (1 << 16)
+/* Output that a session keeps for resuming clients (a power of two). */
+#define HISTORY_SIZE     (1 << 18)
+/* MSG_RESUME from a client that has not seen any output. */
+#define SEQ_NONE         UINT64_MAX
+/* MSG_OPEN with this in pkt.len doesn't create a missing session. */
+#define OPEN_EXISTING    1
+#define RESUME_TRIES     10
+
 enum
 {
   REDRAW_UNSPEC  = 0,
@@ -42,6 +75,30 @@ enum
   REDRAW_WINCH  = 3,
 };
 
+enum {
+  SPLICE_DISABLED = -1,
+  SPLICE_UNTRIED  =  0,
+  SPLICE_READY    =  1,
+};
+
+/* what pty_splice() did */
+enum {
+  SPLICE_EOF      = -2,
+  SPLICE_FALLBACK = -1,
+  SPLICE_AGAIN    =  0,
+  SPLICE_MOVED    =  1,
+};
+
+/* The first member of what is registered to epoll, the listening
+** socket is registered with a NULL pointer. */
+enum {
+  EP_SESSION = 1,
+  EP_CLIENT  = 2,
+  EP_SIGCHLD = 3,
+  EP_SHM     = 4,
+  EP_METRICS = 5,
+};
+
 struct packet {
   unsigned char type;
   unsigned char len;
@@ -51,6 +108,40 @@ struct packet {
   } u;
 };
 
+/* A daemon reaps its sessions from the loop, once the SIGCHLD handler
+** has written to this pipe. */
+struct sigchld_pipe {
+  int ep_kind;
+  int fd[2];
+};
+
+/* A single producer (the master), single consumer (the client) ring in
+** a memfd mapped by both. head and tail are running byte counts. A side
+** that is about to sleep sets its waiting flag and is woken through its
+** eventfd by the other side. */
+struct shm_ring {
+  _Alignas(64) _Atomic uint64_t head;
+  _Alignas(64) _Atomic uint64_t tail;
+  _Alignas(64) _Atomic int reader_waiting;
+  _Atomic int writer_waiting;
+  uint32_t size;
+  _Alignas(64) unsigned char data[];
+};
+
+struct shm_link {
+  int ep_kind;
+  struct client *client;
+};
+
+/* The counters are written in the Prometheus text format to fname, by a
+** timer in the epoll set, so the loop does nothing more between them. */
+struct metrics {
+  int ep_kind;
+  int fd;
+  int interval;
+  char fname[PATH_MAX];
+};
+
 struct pty {
   int fd;
   pid_t pid;
@@ -58,11 +149,73 @@ struct pty {
   struct winsize ws;
 };
 
+/* A pty and the process that runs on it. A plain master hosts exactly one
+** unnamed session, a daemon any number of named ones. */
+struct session {
+  int ep_kind;
+  struct session *next;
+  struct session **pprev;
+
+  char *name;
+  struct pty pty;
+
+  int
+    is_dead,
+    waitattach,
+    num_attached,
+    pty_throttled,
+    pty_reading;
+
+  /* the input that the program hasn't taken yet */
+  char *input;
+  size_t
+    in_off,
+    in_len,
+    in_size;
+  int in_armed;
+
+  /* a pipe to splice() the output through, when a single client is attached */
+  int splice_state;
+  int splice_fd[2];
+
+  /* out_seq counts every byte read from the pty. Once a client asks to
+  ** resume, the last HISTORY_SIZE bytes since hist_start are kept. */
+  uint64_t
+    out_seq,
+    hist_start;
+  char *history;
+};
+
 struct client {
+  int ep_kind;
   struct client *next;
   struct client **pprev;
+  struct session *session;
+
   int fd;
   int attached;
+  int is_dead;
+  int close_on_flush;
+  int out_armed;
+  int in_paused;
+
+  char *queue;
+  size_t
+    q_off,
+    q_len,
+    q_size;
+
+  char *in;
+  size_t
+    in_len,
+    in_size;
+
+  /* the shared memory transport, if the client asked for it */
+  struct shm_ring *ring;
+  struct shm_link shm_link;
+  int
+    data_efd,
+    space_efd;
 };
 
 struct vtach_prop {
@@ -80,8 +233,50 @@ struct vtach_prop {
     waitattach,
     dont_have_tty;
 
+  int
+    epfd,
+    sock_fd,
+    is_daemon,
+    has_dead_clients;
+
+  mode_t sock_mode;
+
   struct client *clients;
-  struct pty pty;
+  struct session *sessions;
+
+  struct sigchld_pipe sigchld;
+
+  /* the session that a client asks for, when it connects to a daemon */
+  char *session_name;
+  char **session_argv;
+  int session_argc;
+
+  /* the client side of the shared memory transport */
+  int transport;
+
+  int splice_state;
+  int splice_fd[2];
+
+  /* the position of the client in the output of the master */
+  int
+    resume,
+    out_seq_valid;
+  uint64_t out_seq;
+
+  struct shm_ring *ring;
+  int
+    data_efd,
+    space_efd;
+
+  /* vwm runs in the master, and renders straight to the clients */
+  int
+    integrated,
+    input_fd;
+
+  /* restored at start, if it exists, and saved when vwm quits */
+  char *snapshot;
+
+  struct metrics metrics;
 
   void *objects[NUM_OBJECTS];
 
@@ -96,6 +291,30 @@ struct vtach_prop {
 
 static int win_changed;
 
+/* for the atexit() handler, that removes the metrics file of the master */
+static pid_t metrics_pid;
+static char *metrics_fname;
+
+/* the write end of the sigchld pipe of a daemon */
+static int sigchld_wfd = -1;
+
+#ifdef VWM_TRACE
+/* set on SIGUSR2, the events are then written by the loop that got it */
+static volatile sig_atomic_t trace_need_dump;
+
+private void vtach_trace_signal (int sig) {
+  signal (sig, vtach_trace_signal);
+  trace_need_dump = 1;
+}
+
+private void vtach_trace_check (vtach_t *this) {
+  ifnot (trace_need_dump) return;
+
+  trace_need_dump = 0;
+  Vwm.trace_dump ($my(objects)[VWM_OBJECT], NULL);
+}
+#endif
+
 private int fd_set_nonblocking (int fd) {
   int flags = fcntl (fd, F_GETFL);
   if (flags < 0 or fcntl (fd, F_SETFL, flags | O_NONBLOCK) < 0)
@@ -104,8 +323,107 @@ private int fd_set_nonblocking (int fd) {
   return OK;
 }
 
+private size_t shm_ring_map_size (uint32_t size) {
+  return sizeof (struct shm_ring) + size;
+}
+
+private int shm_memfd_create (void) {
+#ifdef SYS_memfd_create
+  return syscall (SYS_memfd_create, "vtach", MFD_CLOEXEC);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/* Called by the master. Copies what fits and returns the number of bytes. */
+private size_t shm_ring_put (struct shm_ring *ring, int data_efd, char *buf, size_t len) {
+  uint64_t head = atomic_load_explicit (&ring->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit (&ring->tail, memory_order_acquire);
+
+  size_t space = ring->size - (size_t) (head - tail);
+  if (len > space) len = space;
+  ifnot (len) return 0;
+
+  size_t off = head & (ring->size - 1);
+  size_t n = ring->size - off;
+  if (n > len) n = len;
+
+  memcpy (ring->data + off, buf, n);
+  if (len > n)
+    memcpy (ring->data, buf + n, len - n);
+
+  atomic_store (&ring->head, head + len);
+
+  if (atomic_exchange (&ring->reader_waiting, 0))
+    eventfd_write (data_efd, 1);
+
+  return len;
+}
+
+/* Called by the client. Writes what is in the ring to fd and returns
+** the number of bytes, with reader_waiting set, when the ring is empty. */
+private ssize_t shm_ring_drain (struct shm_ring *ring, int space_efd, int fd) {
+  ssize_t total = 0;
+
+  for (;;) {
+    uint64_t tail = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit (&ring->head, memory_order_acquire);
+
+    if (head is tail) {
+      atomic_store (&ring->reader_waiting, 1);
+      if (atomic_load (&ring->head) is tail)
+        return total;
+
+      atomic_store (&ring->reader_waiting, 0);
+      continue;
+    }
+
+    size_t off = tail & (ring->size - 1);
+    size_t len = (size_t) (head - tail);
+    if (len > ring->size - off) len = ring->size - off;
+
+    size_t written = 0;
+    while (written < len) {
+      ssize_t n = write (fd, ring->data + off + written, len - written);
+      if (n < 0) {
+        if (errno is EINTR or errno is EAGAIN) continue;
+        return NOTOK;
+      }
+
+      written += n;
+    }
+
+    total += len;
+    atomic_store (&ring->tail, tail + len);
+
+    if (atomic_exchange (&ring->writer_waiting, 0))
+      eventfd_write (space_efd, 1);
+  }
+}
+
+private int splice_pipe_new (int *state, int *fd) {
+  if (*state is SPLICE_READY)
+    return OK;
+
+  if (*state is SPLICE_UNTRIED and -1 isnot pipe2 (fd, O_NONBLOCK|O_CLOEXEC)) {
+    *state = SPLICE_READY;
+    return OK;
+  }
+
+  *state = SPLICE_DISABLED;
+  return NOTOK;
+}
+
+/* The pipe might hold data when splice() to the destination has failed.
+** Hands it back through buf, so it can be sent with a plain write(). */
+private ssize_t splice_pipe_read (int *fd, char *buf, size_t len) {
+  ssize_t n;
+  while (-1 is (n = read (fd[0], buf, len)) and errno is EINTR);
+  return n;
+}
+
 private int vtach_sock_create (vtach_t *this, char *sockname) {
-  (void) this;
   struct sockaddr_un sockun;
 
   if (bytelen (sockname) > sizeof (sockun.sun_path) - 1) {
@@ -139,6 +457,7 @@ private int vtach_sock_create (vtach_t *this, char *sockname) {
     return NOTOK;
   }
 
+  $my(sock_mode) = S_IFSOCK | 0600;
   return s;
 }
 
@@ -190,20 +509,29 @@ private int vtach_sock_send_data (vtach_t *this, int s, char *data, size_t len,
   return OK;
 }
 
-private void update_socket_modes (char *sockname, int exec) {
-  struct stat st;
+/* The master is the only one that changes the socket mode, so the mode
+** that we set last is cached and there is no need to stat() the socket. */
+private void update_socket_modes (vtach_t *this, int exec) {
   mode_t newmode;
 
-  if (stat (sockname, &st) < 0)
-    return;
-
   if (exec)
-    newmode = st.st_mode | S_IXUSR;
+    newmode = $my(sock_mode) | S_IXUSR;
   else
-    newmode = st.st_mode & ~S_IXUSR;
+    newmode = $my(sock_mode) & ~S_IXUSR;
+
+  if ($my(sock_mode) is newmode)
+    return;
+
+  if (-1 isnot chmod ($my(sockname), newmode))
+    $my(sock_mode) = newmode;
+}
 
-  if (st.st_mode != newmode)
-    chmod (sockname, newmode);
+private void pty_sigchld (int sig) {
+  signal (sig, pty_sigchld);
+  int saved_errno = errno;
+  char c = 0;
+  if (-1 is write (sigchld_wfd, &c, 1)) {}
+  errno = saved_errno;
 }
 
 private void pty_die (int sig) {
@@ -258,6 +586,9 @@ static char *ustring_character (utf8 c, char *buf, int *len) {
 private int tty_process_kbd (vtach_t *this, int s, struct packet *pkt) {
   /* Suspend? */
   if (0 is $my(no_suspend) and (pkt->u.buf[0] is $my(term)->raw_mode.c_cc[VSUSP])) {
+    /* What is skipped while detached isn't counted. */
+    $my(out_seq_valid) = 0;
+
     pkt->type = MSG_DETACH;
     write (s, pkt, sizeof (struct packet));
 
@@ -301,6 +632,307 @@ private int tty_process_kbd (vtach_t *this, int s, struct packet *pkt) {
   return 0;
 }
 
+/* Asks a daemon for the session that was set with set.session, which
+** is created with the given command if it doesn't exist. */
+private int tty_open_session (vtach_t *this, int s, int existing) {
+  struct packet pkt;
+  memset (&pkt, 0, sizeof (struct packet));
+  pkt.type = MSG_OPEN;
+  pkt.len = (existing ? OPEN_EXISTING : 0);
+  ioctl (0, TIOCGWINSZ, &pkt.u.ws);
+
+  uint32_t size = bytelen ($my(session_name)) + 1;
+  for (int i = 0; i < $my(session_argc); i++)
+    size += bytelen ($my(session_argv)[i]) + 1;
+
+  size_t len = sizeof (struct packet) + sizeof (uint32_t) + size;
+  char *buf = Alloc (len);
+  char *sp = buf;
+
+  memcpy (sp, &pkt, sizeof (struct packet)); sp += sizeof (struct packet);
+  memcpy (sp, &size, sizeof (uint32_t)); sp += sizeof (uint32_t);
+
+  size_t n = bytelen ($my(session_name)) + 1;
+  memcpy (sp, $my(session_name), n); sp += n;
+
+  for (int i = 0; i < $my(session_argc); i++) {
+    n = bytelen ($my(session_argv)[i]) + 1;
+    memcpy (sp, $my(session_argv)[i], n); sp += n;
+  }
+
+  int retval = OK;
+  for (sp = buf; len;) {
+    ssize_t w = write (s, sp, len);
+    if (w < 0) {
+      if (errno is EINTR) continue;
+      retval = NOTOK;
+      break;
+    }
+
+    sp += w;
+    len -= w;
+  }
+
+  free (buf);
+  return retval;
+}
+
+/* Asks the master for the shared memory transport. This is sent before
+** MSG_ATTACH, so the reply is the first thing that the master writes. */
+private int tty_shm_attach (vtach_t *this, int s) {
+  struct packet pkt;
+  memset (&pkt, 0, sizeof (struct packet));
+  pkt.type = MSG_SHM;
+
+  if (-1 is write (s, &pkt, sizeof (struct packet)))
+    return NOTOK;
+
+  char reply;
+  int fds[3];
+  union {
+    char buf[CMSG_SPACE(sizeof (fds))];
+    struct cmsghdr align;
+  } u;
+
+  struct iovec iov = {.iov_base = &reply, .iov_len = 1};
+  struct msghdr msg;
+  memset (&msg, 0, sizeof (struct msghdr));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = u.buf;
+  msg.msg_controllen = sizeof (u.buf);
+
+  ssize_t n;
+  while (-1 is (n = recvmsg (s, &msg, 0)) and errno is EINTR);
+
+  if (n isnot 1 or reply isnot 1)
+    return NOTOK;
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (NULL is cmsg or cmsg->cmsg_type isnot SCM_RIGHTS or
+      cmsg->cmsg_len isnot CMSG_LEN(sizeof (fds)))
+    return NOTOK;
+
+  memcpy (fds, CMSG_DATA(cmsg), sizeof (fds));
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (-1 isnot fstat (fds[0], &st))
+    map = mmap (NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fds[0], 0);
+
+  close (fds[0]);
+
+  if (map is MAP_FAILED) {
+    close (fds[1]);
+    close (fds[2]);
+    return NOTOK;
+  }
+
+  $my(ring) = map;
+  $my(data_efd) = fds[1];
+  $my(space_efd) = fds[2];
+  return OK;
+}
+
+/* stdout might be non blocking, and then it can be full */
+private int tty_wait_stdout (void) {
+  struct pollfd pfd;
+  pfd.fd = STDOUT_FILENO;
+  pfd.events = POLLOUT;
+
+  while (-1 is poll (&pfd, 1, -1))
+    if (errno isnot EINTR)
+      return NOTOK;
+
+  return OK;
+}
+
+private int tty_write_stdout (char *buf, size_t len) {
+  while (len) {
+    ssize_t n = write (STDOUT_FILENO, buf, len);
+
+    if (n > 0) {
+      buf += n;
+      len -= n;
+      continue;
+    }
+
+    if (n < 0 and errno is EINTR)
+      continue;
+
+    if (n < 0 and errno is EAGAIN and OK is tty_wait_stdout ())
+      continue;
+
+    return NOTOK;
+  }
+
+  return OK;
+}
+
+/* Moves the output from the socket to stdout. With splice() this never
+** goes through user space; when the kernel can not splice to stdout
+** (as some ttys), this falls back to read() and write() for good.
+** Returns what has been moved, which is 0 when the socket had nothing
+** after all, SPLICE_EOF at its end, or -1 on an error. */
+private ssize_t tty_relay_output (vtach_t *this, int s, unsigned char *buf, size_t size) {
+  ssize_t len;
+
+  if (OK is splice_pipe_new (&$my(splice_state), $my(splice_fd))) {
+    while (-1 is (len = splice (s, NULL, $my(splice_fd)[1], NULL, SPLICE_LEN,
+        SPLICE_F_MOVE|SPLICE_F_NONBLOCK)) and errno is EINTR);
+
+    if (len is 0)
+      return SPLICE_EOF;
+
+    if (len < 0) {
+      if (errno is EAGAIN)
+        return 0;
+
+      if (errno isnot EINVAL)
+        return -1;
+
+      $my(splice_state) = SPLICE_DISABLED;
+      goto copy;
+    }
+
+    size_t moved = 0;
+    while (moved < (size_t) len) {
+      ssize_t n = splice ($my(splice_fd)[0], NULL, STDOUT_FILENO, NULL,
+          len - moved, SPLICE_F_MOVE);
+
+      if (n > 0) {
+        moved += n;
+        continue;
+      }
+
+      if (n < 0 and errno is EINTR)
+        continue;
+
+      if (n < 0 and errno is EAGAIN) {
+        if (OK is tty_wait_stdout ())
+          continue;
+
+        return -1;
+      }
+
+      if (n < 0 and errno isnot EINVAL)
+        return -1;
+
+      $my(splice_state) = SPLICE_DISABLED;
+
+      while (moved < (size_t) len) {
+        ssize_t r = splice_pipe_read ($my(splice_fd), (char *) buf, size);
+        if (r <= 0 or NOTOK is tty_write_stdout ((char *) buf, r))
+          return -1;
+
+        moved += r;
+      }
+    }
+
+    if ($my(splice_state) is SPLICE_DISABLED) {
+      close ($my(splice_fd)[0]);
+      close ($my(splice_fd)[1]);
+    }
+
+    return len;
+  }
+
+copy:
+  while (-1 is (len = read (s, buf, size)) and errno is EINTR);
+
+  if (len is 0)
+    return SPLICE_EOF;
+
+  if (len < 0)
+    return (errno is EAGAIN ? 0 : -1);
+
+  if (NOTOK is tty_write_stdout ((char *) buf, len))
+    return -1;
+
+  return len;
+}
+
+private void tty_shm_detach (vtach_t *this) {
+  ifnot ($my(ring))
+    return;
+
+  munmap ($my(ring), shm_ring_map_size ($my(ring)->size));
+  close ($my(data_efd));
+  close ($my(space_efd));
+  $my(ring) = NULL;
+}
+
+/* Sends MSG_RESUME, in place of MSG_ATTACH, with the position of the last
+** byte that has been seen. The master answers with the position of the
+** output that follows: either the same one, when it replays what has been
+** missed, or its current one, when it redraws the screen. */
+private int tty_resume (vtach_t *this, int s) {
+  struct packet pkt;
+  memset (&pkt, 0, sizeof (struct packet));
+  pkt.type = MSG_RESUME;
+
+  uint64_t seq = ($my(out_seq_valid) ? $my(out_seq) : SEQ_NONE);
+  memcpy (pkt.u.buf, &seq, sizeof (uint64_t));
+
+  if (-1 is write (s, &pkt, sizeof (struct packet)))
+    return NOTOK;
+
+  char *sp = (char *) &seq;
+  size_t got = 0;
+  while (got < sizeof (uint64_t)) {
+    ssize_t n = read (s, sp + got, sizeof (uint64_t) - got);
+    if (n < 0 and errno is EINTR) continue;
+    if (n <= 0) return NOTOK;
+    got += n;
+  }
+
+  $my(out_seq) = seq;
+  $my(out_seq_valid) = 1;
+  return OK;
+}
+
+/* The socket has been lost, but the master might still be there. */
+private int tty_reconnect (vtach_t *this, int *sp) {
+  close (*sp);
+  tty_shm_detach (this);
+
+  int s = NOTOK;
+  for (int i = 0; i < RESUME_TRIES; i++) {
+    s = self(sock.connect, $my(sockname));
+    if (s isnot NOTOK or (errno isnot EAGAIN and errno isnot EINTR))
+      break;
+
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 50000000};
+    nanosleep (&ts, NULL);
+  }
+
+  if (s is NOTOK)
+    return NOTOK;
+
+  if (NULL isnot $my(session_name) and NOTOK is tty_open_session (this, s, 1))
+    goto theerror;
+
+  if ($my(transport) is VTACH_TRANSPORT_SHM)
+    tty_shm_attach (this, s);
+
+  if (NOTOK is tty_resume (this, s))
+    goto theerror;
+
+  struct packet pkt;
+  memset (&pkt, 0, sizeof (struct packet));
+  pkt.type = MSG_WINCH;
+  ioctl (0, TIOCGWINSZ, &pkt.u.ws);
+  write (s, &pkt, sizeof (struct packet));
+
+  *sp = s;
+  return OK;
+
+theerror:
+  tty_shm_detach (this);
+  close (s);
+  return NOTOK;
+}
+
 private int vtach_tty_main (vtach_t *this) {
   int s = self(sock.connect, $my(sockname));
 
@@ -316,6 +948,20 @@ private int vtach_tty_main (vtach_t *this) {
   signal (SIGINT,   tty_die);
   signal (SIGQUIT,  tty_die);
   signal (SIGWINCH, tty_sigwinch_handler);
+#ifdef VWM_TRACE
+  signal (SIGUSR2,  vtach_trace_signal);
+#endif
+
+  if (NULL isnot $my(session_name) and NOTOK is tty_open_session (this, s, 0)) {
+    fprintf (stderr, "%s: %s\n", $my(session_name), strerror (errno));
+    close (s);
+    return 1;
+  }
+
+  $my(ring) = NULL;
+  $my(splice_state) = SPLICE_UNTRIED;
+  if ($my(transport) is VTACH_TRANSPORT_SHM)
+    tty_shm_attach (this, s);
 
   Vterm.raw_mode ($my(term));
   Vterm.screen.save ($my(term));
@@ -323,9 +969,24 @@ private int vtach_tty_main (vtach_t *this) {
 
   struct packet pkt;
 
+  $my(out_seq_valid) = 0;
+
+  if ($my(resume)) {
+    if (NOTOK is tty_resume (this, s)) {
+      fprintf (stderr, EOS "\r\n[can not attach]\r\n");
+      tty_shm_detach (this);
+      close (s);
+      Vterm.orig_mode ($my(term));
+      Vterm.screen.restore ($my(term));
+      return 1;
+    }
+  }
+
   memset (&pkt, 0, sizeof (struct packet));
-  pkt.type = MSG_ATTACH;
-  write (s, &pkt, sizeof (struct packet));
+  ifnot ($my(resume)) {
+    pkt.type = MSG_ATTACH;
+    write (s, &pkt, sizeof (struct packet));
+  }
 
   pkt.type = MSG_REDRAW;
   pkt.len = $my(redraw_method);
@@ -338,12 +999,19 @@ private int vtach_tty_main (vtach_t *this) {
   fd_set readfds;
 
   while (1) {
+    int max_fd = s;
+    if ($my(ring) and $my(data_efd) > max_fd)
+      max_fd = $my(data_efd);
 
     FD_ZERO(&readfds);
     FD_SET(STDIN_FILENO, &readfds);
     FD_SET(s, &readfds);
+    if ($my(ring))
+      FD_SET($my(data_efd), &readfds);
 
-    int n = select (s + 1, &readfds, NULL, NULL, NULL);
+    VWM_TRACE_BEGIN ("tty_select");
+    int n = select (max_fd + 1, &readfds, NULL, NULL, NULL);
+    VWM_TRACE_END ("tty_select");
 
     if (n < 0 and errno isnot EINTR and errno isnot EAGAIN) {
       fprintf (stderr, EOS "\r\n[select failed]\r\n");
@@ -351,10 +1019,19 @@ private int vtach_tty_main (vtach_t *this) {
       break;
     }
 
+#ifdef VWM_TRACE
+    vtach_trace_check (this);
+#endif
+
     if (n > 0 and FD_ISSET(s, &readfds)) {
-      ssize_t len = read (s, buf, sizeof (buf));
+      VWM_TRACE_BEGIN ("tty_relay");
+      ssize_t len = tty_relay_output (this, s, buf, sizeof (buf));
+      VWM_TRACE_END ("tty_relay");
+
+      if (len < 0 and $my(resume) and OK is tty_reconnect (this, &s))
+        continue;
 
-      if (len is 0) {
+      if (len is SPLICE_EOF) {
         fprintf (stderr, EOS "\r\n[EOF - terminating]\r\n");
         break;
       } else if (len < 0) {
@@ -363,7 +1040,24 @@ private int vtach_tty_main (vtach_t *this) {
         break;
       }
 
-      write (STDOUT_FILENO, buf, len);
+      $my(out_seq) += len;
+      n--;
+    }
+
+    /* Output straight from the mapping. */
+    if (n > 0 and $my(ring) and FD_ISSET($my(data_efd), &readfds)) {
+      eventfd_t val;
+      eventfd_read ($my(data_efd), &val);
+
+      VWM_TRACE_BEGIN ("tty_drain");
+      ssize_t len = shm_ring_drain ($my(ring), $my(space_efd), STDOUT_FILENO);
+      VWM_TRACE_END ("tty_drain");
+      if (len < 0) {
+        retval = -1;
+        break;
+      }
+
+      $my(out_seq) += len;
       n--;
     }
 
@@ -395,30 +1089,46 @@ private int vtach_tty_main (vtach_t *this) {
     }
   }
 
+  tty_shm_detach (this);
+
+  if ($my(splice_state) is SPLICE_READY) {
+    close ($my(splice_fd)[0]);
+    close ($my(splice_fd)[1]);
+  }
+
   Vterm.orig_mode ($my(term));
   Vterm.screen.restore ($my(term));
 
-  if (1 isnot retval)
+  /* The socket of a daemon outlives its sessions. */
+  if (1 isnot retval and NULL is $my(session_name))
     unlink ($my(sockname));
 
   return (retval is -1 ? 1 : 0);
 }
 
-private int pty_child (vtach_t *this, int argc, char **argv) {
-  $my(pty).term = $my(term)->orig_mode;
-  memset (&$my(pty).ws, 0, sizeof (struct winsize));
+/* After vwm quit with MODKEY-q, the windows that are still there.  The
+** sessions of a daemon would all share the file, so they are not saved. */
+private void pty_save_snapshot (vtach_t *this, vwm_t *vwm) {
+  if (NULL is $my(snapshot) or $my(is_daemon) or 0 is Vwm.get.num_wins (vwm))
+    return;
 
-  char name[1024];
-  $my(pty).pid = forkpty (&$my(pty).fd, name, &$my(pty).term, NULL);
+  Vwm.save_snapshot (vwm, $my(snapshot), 0);
+}
+
+private int pty_child (vtach_t *this, struct session *sess, int argc, char **argv) {
+  sess->pty.term = $my(term)->orig_mode;
+
+  char name[1024];
+  sess->pty.pid = forkpty (&sess->pty.fd, name, &sess->pty.term, NULL);
 
-  if ($my(pty).pid < 0)
+  if (sess->pty.pid < 0)
     return -1;
 
-  if ($my(pty).pid is 0) {
+  if (sess->pty.pid is 0) {
     setsid ();
 
     int fd = open (name, O_RDWR|O_CLOEXEC|O_NOCTTY);
-    close ($my(pty).fd);
+    close (sess->pty.fd);
 
     close (0);
     close (1);
@@ -431,6 +1141,35 @@ private int pty_child (vtach_t *this, int argc, char **argv) {
     ioctl (0, TIOCSCTTY, 1);
 
     vwm_t *vwm = $my(objects)[VWM_OBJECT];
+
+    /* A daemon forks sessions from within its loop, so drop what belongs
+    ** to the daemon and to the other sessions, and set up the windows here. */
+    if ($my(is_daemon)) {
+      close ($my(epfd));
+      close ($my(sock_fd));
+
+      for (struct client *c = $my(clients); c; c = c->next) {
+        close (c->fd);
+
+        if (c->ring) {
+          close (c->data_efd);
+          close (c->space_efd);
+        }
+      }
+
+      for (struct session *o = $my(sessions); o; o = o->next) {
+        close (o->pty.fd);
+
+        if (o->splice_state is SPLICE_READY) {
+          close (o->splice_fd[0]);
+          close (o->splice_fd[1]);
+        }
+      }
+
+      if (sess->pty.ws.ws_row and sess->pty.ws.ws_col)
+        Vwm.set.size (vwm, sess->pty.ws.ws_row, sess->pty.ws.ws_col, 1);
+    }
+
     int rows = Vwm.get.lines (vwm);
     int cols = Vwm.get.columns (vwm);
 
@@ -441,180 +1180,1411 @@ private int pty_child (vtach_t *this, int argc, char **argv) {
     wsiz.ws_ypixel = 0;
     ioctl (fd, TIOCSWINSZ, &wsiz);
 
-    close (fd);
+    close (fd);
+
+    int retval = 1;
+    if (0 is $my(is_daemon) or OK is $my(pty_main_cb) (this, argc, argv))
+      retval = $my(exec_child_cb) (this, argc, argv);
+
+    pty_save_snapshot (this, vwm);
+
+    __deinit_vwm__ (&vwm);
+    __deinit_vtach__ (&this);
+
+    _exit (retval);
+  }
+
+  return 0;
+}
+
+private void killpty (struct pty *pty, int sig) {
+  pid_t pgrp = -1;
+
+#ifdef TIOCSIGNAL
+  if (ioctl (pty->fd, TIOCSIGNAL, sig) >= 0)
+    return;
+#endif
+
+#ifdef TIOCSIG
+  if (ioctl (pty->fd, TIOCSIG, sig) >= 0)
+    return;
+#endif
+
+#ifdef TIOCGPGRP
+  if (ioctl (pty->fd, TIOCGPGRP, &pgrp) >= 0 and pgrp isnot -1 and
+    kill (-pgrp, sig) >= 0)
+    return;
+#endif
+
+  /* Fallback using the child's pid. */
+  kill (-pty->pid, sig);
+}
+
+private int pty_epoll_add (vtach_t *this, int fd, uint32_t events, void *ptr) {
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = ptr;
+  return epoll_ctl ($my(epfd), EPOLL_CTL_ADD, fd, &ev);
+}
+
+private void pty_activity (vtach_t *, struct session *);
+
+/* An attached client of the session, that has more than CLIENT_MAX_QUEUE
+** queued, and that the pty waits for. */
+private struct client *pty_session_slow_client (vtach_t *this, struct session *sess) {
+  for (struct client *c = $my(clients); c; c = c->next)
+    if (c->session is sess and c->attached and c->q_len > CLIENT_MAX_QUEUE)
+      return c;
+
+  return NULL;
+}
+
+/* The pty is read again, once none of the clients is behind. This is
+** checked whenever one catches up, goes away or detaches. */
+private void pty_session_unthrottle (vtach_t *this, struct session *sess) {
+  if (NULL is sess or sess->is_dead or 0 is sess->pty_throttled)
+    return;
+
+  if (NULL isnot pty_session_slow_client (this, sess))
+    return;
+
+  sess->pty_throttled = 0;
+
+  /* In the integrated mode, it is the renderer that waits. */
+  if ($my(integrated))
+    return;
+
+  /* There won't be a new edge for data that is already in the pty. */
+  pty_activity (this, sess);
+}
+
+private void pty_client_set_attached (vtach_t *this, struct client *p, int attached) {
+  if (p->attached is attached)
+    return;
+
+  struct session *sess = p->session;
+  int had_attached_client = sess->num_attached > 0;
+
+  p->attached = attached;
+  sess->num_attached += (attached ? 1 : -1);
+
+  /* chmod the socket only when this really changes. A daemon has
+  ** a single socket for all of its sessions, so it leaves it alone. */
+  if (0 is $my(is_daemon) and
+      had_attached_client isnot (sess->num_attached > 0))
+    update_socket_modes (this, sess->num_attached > 0);
+}
+
+/* Clients are released after the current batch of events has been
+** handled, as a later event in the same batch might refer to them. */
+private void pty_client_kill (vtach_t *this, struct client *p) {
+  if (p->is_dead)
+    return;
+
+  if (p->session)
+    pty_client_set_attached (this, p, 0);
+
+  p->is_dead = 1;
+  p->q_off = p->q_len = 0;
+  $my(has_dead_clients) = 1;
+
+  /* the session might wait for this client only */
+  pty_session_unthrottle (this, p->session);
+}
+
+private void pty_session_kill (vtach_t *this, struct session *sess) {
+  sess->is_dead = 1;
+
+  for (struct client *p = $my(clients); p; p = p->next)
+    if (p->session is sess)
+      pty_client_kill (this, p);
+
+  epoll_ctl ($my(epfd), EPOLL_CTL_DEL, sess->pty.fd, NULL);
+  $my(has_dead_clients) = 1;
+}
+
+private void pty_release_dead_clients (vtach_t *this) {
+  ifnot ($my(has_dead_clients))
+    return;
+
+  struct client *p, *next;
+  for (p = $my(clients); p; p = next) {
+    next = p->next;
+
+    ifnot (p->is_dead)
+      continue;
+
+    close (p->fd);
+
+    if (p->next)
+      p->next->pprev = p->pprev;
+    *(p->pprev) = p->next;
+
+    if (p->queue)
+      free (p->queue);
+
+    if (p->in)
+      free (p->in);
+
+    if (p->ring) {
+      munmap (p->ring, shm_ring_map_size (p->ring->size));
+      close (p->data_efd);
+      close (p->space_efd);
+    }
+
+    free (p);
+  }
+
+  struct session *sess, *snext;
+  for (sess = $my(sessions); sess; sess = snext) {
+    snext = sess->next;
+
+    ifnot (sess->is_dead)
+      continue;
+
+    close (sess->pty.fd);
+    waitpid (sess->pty.pid, NULL, WNOHANG);
+
+    if (sess->splice_state is SPLICE_READY) {
+      close (sess->splice_fd[0]);
+      close (sess->splice_fd[1]);
+    }
+
+    if (sess->next)
+      sess->next->pprev = sess->pprev;
+    *(sess->pprev) = sess->next;
+
+    if (sess->name)
+      free (sess->name);
+
+    if (sess->input)
+      free (sess->input);
+
+    if (sess->history)
+      free (sess->history);
+
+    free (sess);
+  }
+
+  $my(has_dead_clients) = 0;
+}
+
+private void pty_client_queue (struct client *p, char *buf, size_t len) {
+  if (p->q_off + p->q_len + len > p->q_size) {
+    if (p->q_off) {
+      memmove (p->queue, p->queue + p->q_off, p->q_len);
+      p->q_off = 0;
+    }
+
+    if (p->q_len + len > p->q_size) {
+      size_t size = p->q_size ? p->q_size : BUFSIZE;
+      while (size < p->q_len + len) size *= 2;
+      p->queue = Realloc (p->queue, size);
+      p->q_size = size;
+    }
+  }
+
+  memcpy (p->queue + p->q_off + p->q_len, buf, len);
+  p->q_len += len;
+}
+
+/* Moves the queue of a shared memory client into its ring. When the ring
+** is full, the client signals space_efd once it has made some room. */
+private void pty_client_shm_flush (struct client *p) {
+  while (p->q_len) {
+    size_t n = shm_ring_put (p->ring, p->data_efd, p->queue + p->q_off, p->q_len);
+
+    if (n) {
+      p->q_off += n;
+      p->q_len -= n;
+      continue;
+    }
+
+    atomic_store (&p->ring->writer_waiting, 1);
+
+    uint64_t head = atomic_load_explicit (&p->ring->head, memory_order_relaxed);
+    if (head - atomic_load (&p->ring->tail) is p->ring->size)
+      return;
+
+    atomic_store (&p->ring->writer_waiting, 0);
+  }
+
+  p->q_off = 0;
+}
+
+/* EPOLLOUT is asked for only while output is pending on the socket,
+** otherwise every read by the client would wake up the master. */
+private void pty_client_arm (vtach_t *this, struct client *p) {
+  int want = (p->q_len > 0 and NULL is p->ring);
+
+  if (p->is_dead or want is p->out_armed)
+    return;
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN|EPOLLET|(want ? EPOLLOUT : 0);
+  ev.data.ptr = p;
+
+  if (0 is epoll_ctl ($my(epfd), EPOLL_CTL_MOD, p->fd, &ev))
+    p->out_armed = want;
+}
+
+private void pty_client_write_fd (vtach_t *this, struct client *p, char *buf, size_t len) {
+  /* Keep the order, if there is already pending output. */
+  ifnot (p->q_len) {
+    while (len) {
+      ssize_t n = write (p->fd, buf, len);
+
+      if (n > 0) {
+        buf += n;
+        len -= n;
+        continue;
+      } else if (n < 0 and errno is EINTR)
+        continue;
+      else if (n < 0 and errno is EAGAIN)
+        break;
+
+      pty_client_kill (this, p);
+      return;
+    }
+
+    ifnot (len)
+      return;
+  }
+
+  pty_client_queue (p, buf, len);
+  pty_client_arm (this, p);
+
+  if (p->session and p->q_len > CLIENT_MAX_QUEUE)
+    p->session->pty_throttled = 1;
+}
+
+private void pty_client_write (vtach_t *this, struct client *p, char *buf, size_t len) {
+  if (p->ring) {
+    ifnot (p->q_len) {
+      size_t n = shm_ring_put (p->ring, p->data_efd, buf, len);
+      ifnot (len -= n)
+        return;
+
+      buf += n;
+    }
+
+    pty_client_queue (p, buf, len);
+    pty_client_shm_flush (p);
+  } else {
+    pty_client_write_fd (this, p, buf, len);
+    return;
+  }
+
+  if (p->session and p->q_len > CLIENT_MAX_QUEUE)
+    p->session->pty_throttled = 1;
+}
+
+/* Moves output from the pty to the only attached client through the pipe
+** of the session. What the socket doesn't take is read back from the pipe
+** into the queue of the client, so the order is kept. */
+private int pty_splice (vtach_t *this, struct session *sess, struct client *p) {
+  ssize_t len;
+  int *fd = sess->splice_fd;
+
+  while (-1 is (len = splice (sess->pty.fd, NULL, fd[1], NULL, SPLICE_LEN,
+      SPLICE_F_MOVE|SPLICE_F_NONBLOCK)) and errno is EINTR);
+
+  if (len < 0 and errno is EAGAIN)
+    return SPLICE_AGAIN;
+
+  if (len < 0 and errno is EINVAL) {
+    close (fd[0]);
+    close (fd[1]);
+    sess->splice_state = SPLICE_DISABLED;
+    return SPLICE_FALLBACK;
+  }
+
+  if (len <= 0)
+    return SPLICE_EOF;
+
+  sess->out_seq += len;
+
+  size_t moved = 0;
+  while (moved < (size_t) len) {
+    ssize_t n = splice (fd[0], NULL, p->fd, NULL, len - moved,
+        SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+    if (n > 0) {
+      moved += n;
+      continue;
+    }
+
+    if (n < 0 and errno is EINTR)
+      continue;
+
+    int err = (n < 0 ? errno : EAGAIN);
+    int keep = (err is EAGAIN or err is EINVAL);
+
+    char buf[BUFSIZE];
+    while (moved < (size_t) len) {
+      ssize_t r = splice_pipe_read (fd, buf, sizeof (buf));
+      if (r <= 0) break;
+
+      if (keep)
+        pty_client_queue (p, buf, r);
+
+      moved += r;
+    }
+
+    ifnot (keep)
+      pty_client_kill (this, p);
+    else {
+      pty_client_arm (this, p);
+      if (p->q_len > CLIENT_MAX_QUEUE)
+        sess->pty_throttled = 1;
+    }
+
+    if (err is EINVAL) {
+      close (fd[0]);
+      close (fd[1]);
+      sess->splice_state = SPLICE_DISABLED;
+    }
+
+    break;
+  }
+
+  return SPLICE_MOVED;
+}
+
+private struct client *pty_splice_client (vtach_t *this, struct session *sess) {
+  /* The output of a session that keeps history passes through here. */
+  if (sess->num_attached isnot 1 or sess->splice_state is SPLICE_DISABLED or
+      sess->history)
+    return NULL;
+
+  for (struct client *p = $my(clients); p; p = p->next) {
+    if (p->session isnot sess or 0 is p->attached)
+      continue;
+
+    if (p->ring or p->q_len or NOTOK is splice_pipe_new (&sess->splice_state, sess->splice_fd))
+      return NULL;
+
+    return p;
+  }
+
+  return NULL;
+}
+
+private void pty_session_record (struct session *sess, char *buf, size_t len) {
+  if (sess->history) {
+    if (len > HISTORY_SIZE) {
+      sess->out_seq += len - HISTORY_SIZE;
+      buf += len - HISTORY_SIZE;
+      len = HISTORY_SIZE;
+    }
+
+    size_t off = sess->out_seq & (HISTORY_SIZE - 1);
+    size_t n = HISTORY_SIZE - off;
+    if (n > len) n = len;
+
+    memcpy (sess->history + off, buf, n);
+    if (len > n)
+      memcpy (sess->history, buf + n, len - n);
+  }
+
+  sess->out_seq += len;
+}
+
+private void pty_activity (vtach_t *this, struct session *sess) {
+  unsigned char buf[BUFSIZE];
+  ssize_t len;
+  struct client *p;
+  int has_read = 0;
+
+  /* A client that goes while the output is written to the clients, might
+  ** unthrottle the session from in here; the loop below goes on reading. */
+  if (sess->pty_reading)
+    return;
+
+  sess->pty_reading = 1;
+
+  /* The pty is edge triggered, so drain it, unless a client
+  ** can not keep up, in which case the kernel buffers the rest. */
+  while (0 is sess->pty_throttled) {
+    if (NULL isnot (p = pty_splice_client (this, sess))) {
+      int retval = pty_splice (this, sess, p);
+
+      if (retval is SPLICE_AGAIN)
+        break;
+
+      if (retval is SPLICE_MOVED) {
+        has_read = 1;
+        continue;
+      }
+
+      if (retval is SPLICE_EOF) {
+        ifnot ($my(is_daemon))
+          exit (1);
+
+        pty_session_kill (this, sess);
+        goto theend;
+      }
+    }
+
+    len = read (sess->pty.fd, buf, sizeof (buf));
+
+    if (len < 0 and errno is EINTR)
+      continue;
+
+    if (len < 0 and errno is EAGAIN)
+      break;
+
+    if (len <= 0) {
+      ifnot ($my(is_daemon))
+        exit (1);
+
+      pty_session_kill (this, sess);
+      goto theend;
+    }
+
+    has_read = 1;
+    pty_session_record (sess, (char *) buf, len);
+
+    for (p = $my(clients); p; p = p->next) {
+      if (p->session isnot sess or 0 is p->attached)
+        continue;
+
+      pty_client_write (this, p, (char *) buf, len);
+    }
+  }
+
+  if (has_read and tcgetattr (sess->pty.fd, &sess->pty.term) < 0) {
+    ifnot ($my(is_daemon))
+      exit (1);
+
+    pty_session_kill (this, sess);
+  }
+
+theend:
+  sess->pty_reading = 0;
+}
+
+private void pty_client_flush (vtach_t *this, struct client *p) {
+  if (p->ring) {
+    pty_client_shm_flush (p);
+    if (p->q_len)
+      return;
+  }
+
+  while (p->q_len) {
+    ssize_t n = write (p->fd, p->queue + p->q_off, p->q_len);
+
+    if (n > 0) {
+      p->q_off += n;
+      p->q_len -= n;
+      continue;
+    } else if (n < 0 and errno is EINTR)
+      continue;
+    else if (n < 0 and errno is EAGAIN)
+      return;
+
+    pty_client_kill (this, p);
+    break;
+  }
+
+  p->q_off = 0;
+  pty_client_arm (this, p);
+
+  if (p->close_on_flush) {
+    pty_client_kill (this, p);
+    return;
+  }
+
+  pty_session_unthrottle (this, p->session);
+}
+
+private struct session *pty_session_new (vtach_t *this, char *name, struct winsize *ws, int argc, char **argv) {
+  struct session *sess = Alloc (sizeof (struct session));
+
+  sess->ep_kind = EP_SESSION;
+  sess->waitattach = $my(waitattach);
+
+  if (NULL isnot ws)
+    sess->pty.ws = *ws;
+
+  if (pty_child (this, sess, argc, argv) < 0) {
+    free (sess);
+    return NULL;
+  }
+
+  if (NULL isnot name)
+    sess->name = strdup (name);
+
+  fd_set_nonblocking (sess->pty.fd);
+  fcntl (sess->pty.fd, F_SETFD, FD_CLOEXEC);
+
+  sess->pprev = &$my(sessions);
+  sess->next = *(sess->pprev);
+  if (sess->next)
+    sess->next->pprev = &sess->next;
+  *(sess->pprev) = sess;
+
+  /* When waitattach is set, the pty is not watched until
+  ** the first client attaches. */
+  ifnot (sess->waitattach)
+    pty_epoll_add (this, sess->pty.fd, EPOLLIN|EPOLLET, sess);
+
+  return sess;
+}
+
+private void pty_socket_activity (vtach_t *this, int s) {
+  for (;;) {
+    int fd = accept (s, NULL, NULL);
+    if (fd < 0) {
+      if (errno is EINTR)
+        continue;
+
+      return;
+    }
+
+    if (fd_set_nonblocking (fd) < 0) {
+      close (fd);
+      continue;
+    }
+
+    fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+    struct client *p = Alloc (sizeof (struct client));
+
+    p->ep_kind = EP_CLIENT;
+    p->fd = fd;
+    p->attached = 0;
+
+    /* A plain master has only one session; a daemon waits for MSG_OPEN. */
+    ifnot ($my(is_daemon))
+      p->session = $my(sessions);
+
+    if (-1 is pty_epoll_add (this, fd, EPOLLIN|EPOLLET, p)) {
+      close (fd);
+      free (p);
+      continue;
+    }
+
+    p->pprev = &$my(clients);
+    p->next = *(p->pprev);
+    if (p->next)
+      p->next->pprev = &p->next;
+    *(p->pprev) = p;
+  }
+}
+
+/* The payload of MSG_OPEN is the session name followed by the argv of
+** the command, each one NUL terminated; the packet carries the winsize. */
+private void pty_client_open (vtach_t *this, struct client *p, struct packet *pkt, char *data, size_t size) {
+  if (NULL isnot p->session or 0 is size or data[size - 1] isnot '\0') {
+    pty_client_kill (this, p);
+    return;
+  }
+
+  char *name = data;
+  struct session *sess = $my(sessions);
+
+  while (sess) {
+    if (0 is sess->is_dead and 0 is strcmp (sess->name, name))
+      break;
+
+    sess = sess->next;
+  }
+
+  if (NULL is sess) {
+    if (pkt->len is OPEN_EXISTING) {
+      pty_client_kill (this, p);
+      return;
+    }
+
+    int argc = 0;
+    char *sp = name + bytelen (name) + 1;
+    char *end = data + size;
+
+    for (char *tmp = sp; tmp < end; tmp += bytelen (tmp) + 1)
+      argc++;
+
+    char **argv = Alloc (sizeof (char *) * (argc + 1));
+    for (int i = 0; i < argc; i++) {
+      argv[i] = sp;
+      sp += bytelen (sp) + 1;
+    }
+
+    argv[argc] = NULL;
+
+    sess = pty_session_new (this, name, &pkt->u.ws, argc, argv);
+    free (argv);
+
+    if (NULL is sess) {
+      pty_client_kill (this, p);
+      return;
+    }
+  }
+
+  p->session = sess;
+}
+
+/* MSG_LIST: one line per session, with the number of attached clients. */
+private void pty_client_list (vtach_t *this, struct client *p) {
+  char buf[256];
+
+  for (struct session *sess = $my(sessions); sess; sess = sess->next) {
+    if (sess->is_dead or NULL is sess->name)
+      continue;
+
+    int len = snprintf (buf, sizeof (buf), "%s\t%d\t%d\n",
+        sess->name, sess->pty.pid, sess->num_attached);
+
+    if (len >= (int) sizeof (buf))
+      len = sizeof (buf) - 1;
+
+    pty_client_write (this, p, buf, len);
+  }
+
+  if (p->q_len)
+    p->close_on_flush = 1;
+  else
+    pty_client_kill (this, p);
+}
+
+/* The pty of the program, or the pipe to vwm in the integrated mode, does
+** not block, so the input that doesn't fit is kept in the session and
+** written on EPOLLOUT, which is asked for only while there is some. */
+private void pty_session_input_arm (vtach_t *this, struct session *sess) {
+  int want = (sess->in_len > 0);
+
+  if (sess->is_dead or want is sess->in_armed)
+    return;
+
+  struct epoll_event ev;
+  ev.data.ptr = sess;
+
+  if ($my(integrated)) {
+    ev.events = EPOLLOUT;
+    if (0 is epoll_ctl ($my(epfd), want ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, $my(input_fd), &ev))
+      sess->in_armed = want;
+    return;
+  }
+
+  /* not registered before the first attach */
+  if (sess->waitattach)
+    return;
+
+  ev.events = EPOLLIN|EPOLLET|(want ? EPOLLOUT : 0);
+  if (0 is epoll_ctl ($my(epfd), EPOLL_CTL_MOD, sess->pty.fd, &ev))
+    sess->in_armed = want;
+}
+
+private void pty_session_input_write (vtach_t *this, struct session *sess) {
+  int fd = ($my(integrated) ? $my(input_fd) : sess->pty.fd);
+
+  while (sess->in_len) {
+    ssize_t n = write (fd, sess->input + sess->in_off, sess->in_len);
+
+    if (n > 0) {
+      sess->in_off += n;
+      sess->in_len -= n;
+      continue;
+    } else if (n < 0 and errno is EINTR)
+      continue;
+    else if (n < 0 and errno is EAGAIN)
+      break;
+
+    /* the program is gone, and its pty says so as well */
+    sess->in_len = 0;
+  }
+
+  ifnot (sess->in_len)
+    sess->in_off = 0;
+
+  pty_session_input_arm (this, sess);
+}
+
+private void pty_session_input (vtach_t *this, struct session *sess, char *buf, size_t len) {
+  if (sess->in_off + sess->in_len + len > sess->in_size) {
+    if (sess->in_off) {
+      memmove (sess->input, sess->input + sess->in_off, sess->in_len);
+      sess->in_off = 0;
+    }
+
+    if (sess->in_len + len > sess->in_size) {
+      size_t size = sess->in_size ? sess->in_size : BUFSIZE;
+      while (size < sess->in_len + len) size *= 2;
+      sess->input = Realloc (sess->input, size);
+      sess->in_size = size;
+    }
+  }
+
+  memcpy (sess->input + sess->in_off + sess->in_len, buf, len);
+  sess->in_len += len;
+
+  pty_session_input_write (this, sess);
+}
+
+private void pty_client_activity (vtach_t *, struct client *);
+
+/* EPOLLOUT: write what is kept, and go on reading the clients that
+** have been waiting for the program. */
+private void pty_session_input_flush (vtach_t *this, struct session *sess) {
+  pty_session_input_write (this, sess);
+
+  if (sess->in_len >= SESSION_MAX_INPUT)
+    return;
+
+  for (struct client *p = $my(clients); p; p = p->next) {
+    if (p->session isnot sess or 0 is p->in_paused or p->is_dead)
+      continue;
+
+    p->in_paused = 0;
+    pty_client_activity (this, p);
+
+    if (sess->is_dead or sess->in_len >= SESSION_MAX_INPUT)
+      break;
+  }
+}
+
+/* MSG_SHM: replies with one byte, and on success with the memfd of the
+** ring and the two eventfds attached. */
+private void pty_client_shm (vtach_t *this, struct client *p) {
+  char reply = 0;
+  int fds[3] = {-1, -1, -1};
+  struct shm_ring *ring = MAP_FAILED;
+  size_t map_size = shm_ring_map_size (SHM_RING_SIZE);
+
+  if (p->ring or p->attached)
+    goto theend;
+
+  if (-1 is (fds[0] = shm_memfd_create ()) or
+      -1 is ftruncate (fds[0], map_size) or
+      -1 is (fds[1] = eventfd (0, EFD_CLOEXEC|EFD_NONBLOCK)) or
+      -1 is (fds[2] = eventfd (0, EFD_CLOEXEC|EFD_NONBLOCK)))
+    goto theend;
+
+  ring = mmap (NULL, map_size, PROT_READ|PROT_WRITE, MAP_SHARED, fds[0], 0);
+  if (ring is MAP_FAILED)
+    goto theend;
+
+  ring->size = SHM_RING_SIZE;
+  atomic_store (&ring->reader_waiting, 1);
+
+  p->shm_link.ep_kind = EP_SHM;
+  p->shm_link.client = p;
+  if (-1 is pty_epoll_add (this, fds[2], EPOLLIN|EPOLLET, &p->shm_link))
+    goto theend;
+
+  reply = 1;
+
+theend:;
+  union {
+    char buf[CMSG_SPACE(sizeof (fds))];
+    struct cmsghdr align;
+  } u;
+
+  struct iovec iov = {.iov_base = &reply, .iov_len = 1};
+  struct msghdr msg;
+  memset (&msg, 0, sizeof (struct msghdr));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (reply) {
+    msg.msg_control = u.buf;
+    msg.msg_controllen = sizeof (u.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof (fds));
+    memcpy (CMSG_DATA(cmsg), fds, sizeof (fds));
+  }
+
+  /* Nothing has been sent to this client yet, so this doesn't block. */
+  if (1 isnot sendmsg (p->fd, &msg, 0) and reply) {
+    epoll_ctl ($my(epfd), EPOLL_CTL_DEL, fds[2], NULL);
+    reply = 0;
+  }
+
+  if (fds[0] isnot -1)
+    close (fds[0]);
+
+  if (reply) {
+    p->ring = ring;
+    p->data_efd = fds[1];
+    p->space_efd = fds[2];
+    return;
+  }
+
+  if (ring isnot MAP_FAILED)
+    munmap (ring, map_size);
+
+  if (fds[1] isnot -1) close (fds[1]);
+  if (fds[2] isnot -1) close (fds[2]);
+}
+
+private void pty_client_attach (vtach_t *this, struct client *p) {
+  struct session *sess = p->session;
+
+  pty_client_set_attached (this, p, 1);
+
+  if (sess->waitattach) {
+    sess->waitattach = 0;
+    pty_epoll_add (this, sess->pty.fd, EPOLLIN|EPOLLET, sess);
+    pty_session_input_arm (this, sess);
+  }
+}
+
+private void pty_session_redraw (vtach_t *this, struct session *sess) {
+  ifnot ($my(integrated)) {
+    killpty (&sess->pty, SIGWINCH);
+    return;
+  }
+
+  vwm_t *vwm = $my(objects)[VWM_OBJECT];
+  vwm_win *win = Vwm.get.current_win (vwm);
+  if (win)
+    Vwin.draw (win);
+}
+
+/* The integrated counterpart of TIOCSWINSZ; vwm redraws on a new size,
+** once the packets of a drag stop coming. */
+private void pty_session_resize (vtach_t *this, struct session *sess, struct winsize *ws, int redraw) {
+  vwm_t *vwm = $my(objects)[VWM_OBJECT];
+
+  if (ws->ws_row and ws->ws_col) {
+    sess->pty.ws = *ws;
+
+    if (OK is Vwm.queue_resize (vwm, ws->ws_row, ws->ws_col))
+      return;
+  }
+
+  if (redraw)
+    pty_session_redraw (this, sess);
+}
+
+/* MSG_RESUME: attaches the client, but first writes the position in the
+** output that it will get next. When the client has seen some output and
+** what follows is still kept, it is sent again; otherwise the screen is
+** redrawn. History is kept from the first MSG_RESUME on. */
+private void pty_client_resume (vtach_t *this, struct client *p, struct packet *pkt) {
+  struct session *sess = p->session;
+  uint64_t seq;
+  memcpy (&seq, pkt->u.buf, sizeof (uint64_t));
+
+  if (NULL is sess->history) {
+    sess->history = Alloc (HISTORY_SIZE);
+    sess->hist_start = sess->out_seq;
+  }
+
+  uint64_t first = sess->hist_start;
+  if (sess->out_seq - first > HISTORY_SIZE)
+    first = sess->out_seq - HISTORY_SIZE;
+
+  int replay = (seq isnot SEQ_NONE and seq >= first and seq <= sess->out_seq);
+  uint64_t start = (replay ? seq : sess->out_seq);
+
+  /* Nothing else has been sent to this client yet. */
+  if (sizeof (uint64_t) isnot write (p->fd, &start, sizeof (uint64_t))) {
+    pty_client_kill (this, p);
+    return;
+  }
+
+  if (replay and seq < sess->out_seq) {
+    size_t len = sess->out_seq - seq;
+    size_t off = seq & (HISTORY_SIZE - 1);
+    size_t n = HISTORY_SIZE - off;
+    if (n > len) n = len;
+
+    pty_client_write (this, p, sess->history + off, n);
+    if (len > n and 0 is p->is_dead)
+      pty_client_write (this, p, sess->history, len - n);
+  }
+
+  if (p->is_dead)
+    return;
+
+  pty_client_attach (this, p);
+
+  if (0 is replay and seq isnot SEQ_NONE)
+    pty_session_redraw (this, sess);
+}
+
+private void pty_client_packet (vtach_t *this, struct client *p, struct packet *pkt, char *data, size_t size) {
+  if (pkt->type is MSG_OPEN) {
+    if ($my(is_daemon))
+      pty_client_open (this, p, pkt, data, size);
+    return;
+  }
+
+  if (pkt->type is MSG_LIST) {
+    if ($my(is_daemon))
+      pty_client_list (this, p);
+    return;
+  }
+
+  if (pkt->type is MSG_SHM) {
+    pty_client_shm (this, p);
+    return;
+  }
+
+  struct session *sess = p->session;
+  if (NULL is sess)
+    return;
+
+  /* Push out data to the program, or to vwm in the integrated mode. */
+  if (pkt->type is MSG_PUSH) {
+    if (pkt->len <= sizeof (pkt->u.buf))
+      pty_session_input (this, sess, (char *) pkt->u.buf, pkt->len);
+  } else if ($my(integrated) and
+      (pkt->type is MSG_WINCH or pkt->type is MSG_REDRAW)) {
+    if (pkt->type is MSG_WINCH or pkt->len isnot REDRAW_NONE)
+      pty_session_resize (this, sess, &pkt->u.ws, pkt->type is MSG_REDRAW);
+  } else if (pkt->type is MSG_ATTACH)
+    pty_client_attach (this, p);
+  else if (pkt->type is MSG_RESUME)
+    pty_client_resume (this, p, pkt);
+  else if (pkt->type is MSG_DETACH) {
+    pty_client_set_attached (this, p, 0);
+    pty_session_unthrottle (this, sess);
+  }
+  else if (pkt->type is MSG_WINCH) {
+    sess->pty.ws = pkt->u.ws;
+    ioctl (sess->pty.fd, TIOCSWINSZ, &sess->pty.ws);
+  } else if (pkt->type == MSG_REDRAW) {
+    int method = pkt->len;
+
+    /* If the client didn't specify a particular method, use
+    ** whatever we had on startup. */
+    if (method is REDRAW_UNSPEC)
+      method = $my(redraw_method);
+    if (method is REDRAW_NONE)
+      return;
+
+    sess->pty.ws = pkt->u.ws;
+    ioctl (sess->pty.fd, TIOCSWINSZ, &sess->pty.ws);
+
+    /* Send a ^L character if the terminal is in no-echo and
+    ** character-at-a-time mode. */
+    if (method is REDRAW_CTRL_L) {
+      char c = '\f';
+
+      if (((sess->pty.term.c_lflag & (ECHO|ICANON)) is 0) and
+           (sess->pty.term.c_cc[VMIN] is 0))
+           //(sess->pty.term.c_cc[VMIN] is 1)) {
+        write (sess->pty.fd, &c, 1);
+    } else if (method is REDRAW_WINCH)
+      killpty (&sess->pty, SIGWINCH);
+  }
+}
+
+/* Input is buffered, as a packet, or the payload that follows MSG_OPEN,
+** might be split between reads. */
+private void pty_client_activity (vtach_t *this, struct client *p) {
+  struct packet pkt;
+
+  for (;;) {
+    /* The program doesn't take its input, so leave the rest in the socket,
+    ** until it does. */
+    if (p->session and p->session->in_len >= SESSION_MAX_INPUT) {
+      p->in_paused = 1;
+      return;
+    }
+
+    if (p->in_size - p->in_len < BUFSIZE) {
+      p->in_size += BUFSIZE;
+      p->in = Realloc (p->in, p->in_size);
+    }
+
+    ssize_t len = read (p->fd, p->in + p->in_len, p->in_size - p->in_len);
+
+    if (len < 0 and errno is EINTR)
+      continue;
+
+    if (len < 0 and errno is EAGAIN)
+      return;
+
+    if (len <= 0) {
+      pty_client_kill (this, p);
+      return;
+    }
+
+    p->in_len += len;
+
+    size_t off = 0;
+    while (p->in_len - off >= sizeof (struct packet)) {
+      size_t need = sizeof (struct packet);
+      uint32_t size = 0;
+      char *data = NULL;
+
+      memcpy (&pkt, p->in + off, sizeof (struct packet));
+
+      if (pkt.type is MSG_OPEN) {
+        if (p->in_len - off < need + sizeof (uint32_t))
+          break;
+
+        memcpy (&size, p->in + off + need, sizeof (uint32_t));
+        if (size > OPEN_MAX_PAYLOAD) {
+          pty_client_kill (this, p);
+          return;
+        }
+
+        need += sizeof (uint32_t) + size;
+        if (p->in_len - off < need)
+          break;
+
+        data = p->in + off + sizeof (struct packet) + sizeof (uint32_t);
+      }
+
+      pty_client_packet (this, p, &pkt, data, size);
+
+      off += need;
+
+      if (p->is_dead)
+        return;
+    }
+
+    if (off) {
+      p->in_len -= off;
+      memmove (p->in, p->in + off, p->in_len);
+    }
+  }
+}
+
+private void pty_metrics_escape (FILE *fp, const char *val) {
+  for (; *val; val++) {
+    if (*val is '\\' or *val is '"')
+      fputc ('\\', fp);
+
+    if (*val is '\n')
+      fputs ("\\n", fp);
+    else
+      fputc (*val, fp);
+  }
+}
+
+private void pty_metrics_label (FILE *fp, const char *name, const char *val) {
+  fprintf (fp, ",%s=\"", name);
+  pty_metrics_escape (fp, val);
+  fputc ('"', fp);
+}
+
+private void pty_metrics_head (FILE *fp, const char *name, const char *type, const char *help) {
+  fprintf (fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+private void pty_metrics_sample (vtach_t *this, FILE *fp, const char *name) {
+  fprintf (fp, "%s{socket=\"", name);
+  pty_metrics_escape (fp, $my(sockname));
+  fputc ('"', fp);
+}
+
+static const struct {
+  const char *name;
+  const char *help;
+  size_t offset;
+  double scale;
+} frame_metrics[] = {
+  {"vwm_frame_reads_total", "Reads of the frame output.", offsetof (vframe_counters, num_reads), 1},
+  {"vwm_frame_read_bytes_total", "Bytes read from the frame.", offsetof (vframe_counters, bytes_read), 1},
+  {"vwm_frame_rendered_bytes_total", "Bytes rendered for the frame.", offsetof (vframe_counters, bytes_rendered), 1},
+  {"vwm_frame_control_chars_total", "C0 control characters.", offsetof (vframe_counters, num_ctrl), 1},
+  {"vwm_frame_esc_sequences_total", "Escape sequences, other than CSI.", offsetof (vframe_counters, num_esc), 1},
+  {"vwm_frame_csi_sequences_total", "CSI sequences, SGR included.", offsetof (vframe_counters, num_csi), 1},
+  {"vwm_frame_sgr_sequences_total", "SGR sequences.", offsetof (vframe_counters, num_sgr), 1},
+  {"vwm_frame_scrolled_lines_total", "Lines scrolled.", offsetof (vframe_counters, scrolled_lines), 1},
+  {"vwm_frame_redraws_total", "Times the frame was drawn in whole.", offsetof (vframe_counters, num_redraws), 1},
+  {"vwm_frame_parse_seconds_total", "Time spent parsing the output.", offsetof (vframe_counters, parse_ns), 1e-9},
+  {"vwm_frame_write_seconds_total", "Time spent writing the render.", offsetof (vframe_counters, write_ns), 1e-9},
+};
+
+/* vwm is only in this process when it is integrated */
+private void pty_metrics_write_vwm (vtach_t *this, FILE *fp) {
+  vwm_t *vwm = $my(objects)[VWM_OBJECT];
+  vwm_info *vinfo = Vwm.get.info (vwm);
+
+  pty_metrics_head (fp, "vwm_loop_wakeups_total", "counter", "Wakeups of the main loop.");
+  pty_metrics_sample (this, fp, "vwm_loop_wakeups_total");
+  fprintf (fp, "} %lu\n", vinfo->counters.num_wakeups);
+
+  pty_metrics_head (fp, "vwm_loop_select_seconds_total", "counter", "Time spent waiting in select().");
+  pty_metrics_sample (this, fp, "vwm_loop_select_seconds_total");
+  fprintf (fp, "} %.6f\n", vinfo->counters.select_ns / 1e9);
+
+  pty_metrics_head (fp, "vwm_input_bytes_total", "counter", "Bytes of input.");
+  pty_metrics_sample (this, fp, "vwm_input_bytes_total");
+  fprintf (fp, "} %lu\n", vinfo->counters.stdin_bytes);
+
+  pty_metrics_head (fp, "vwm_window_draws_total", "counter", "Draws of the window.");
+  for (int widx = 0; widx < vinfo->num_win; widx++) {
+    pty_metrics_sample (this, fp, "vwm_window_draws_total");
+    pty_metrics_label (fp, "window", (vinfo->wins[widx]->name ? vinfo->wins[widx]->name : ""));
+    fprintf (fp, "} %lu\n", vinfo->wins[widx]->counters.num_draws);
+  }
+
+  pty_metrics_head (fp, "vwm_window_cached_draws_total", "counter", "Draws served from the render cache.");
+  for (int widx = 0; widx < vinfo->num_win; widx++) {
+    pty_metrics_sample (this, fp, "vwm_window_cached_draws_total");
+    pty_metrics_label (fp, "window", (vinfo->wins[widx]->name ? vinfo->wins[widx]->name : ""));
+    fprintf (fp, "} %lu\n", vinfo->wins[widx]->counters.num_cached_draws);
+  }
+
+  for (size_t m = 0; m < sizeof (frame_metrics) / sizeof (frame_metrics[0]); m++) {
+    pty_metrics_head (fp, frame_metrics[m].name, "counter", frame_metrics[m].help);
+
+    for (int widx = 0; widx < vinfo->num_win; widx++) {
+      vwin_info *w_info = vinfo->wins[widx];
+
+      for (int fidx = 0; fidx < w_info->num_frames; fidx++) {
+        char frame[16];
+        snprintf (frame, sizeof (frame), "%d", fidx);
+
+        ulong val = *(ulong *) ((char *) &w_info->frames[fidx]->counters + frame_metrics[m].offset);
+
+        pty_metrics_sample (this, fp, frame_metrics[m].name);
+        pty_metrics_label (fp, "window", (w_info->name ? w_info->name : ""));
+        pty_metrics_label (fp, "frame", frame);
+
+        if (frame_metrics[m].scale is 1)
+          fprintf (fp, "} %lu\n", val);
+        else
+          fprintf (fp, "} %.6f\n", val * frame_metrics[m].scale);
+      }
+    }
+  }
+
+  Vwm.release_info (vwm, &vinfo);
+}
+
+/* Written to a temporary and renamed, so a scraper never sees half of it. */
+private void pty_metrics_write (vtach_t *this) {
+  char tmp[PATH_MAX + 8];
+  snprintf (tmp, sizeof (tmp), "%s.tmp", $my(metrics).fname);
+
+  FILE *fp = fopen (tmp, "w");
+  if (NULL is fp) return;
+
+  long rss_pages = 0;
+  FILE *statm = fopen ("/proc/self/statm", "r");
+  if (statm) {
+    if (1 isnot fscanf (statm, "%*s %ld", &rss_pages))
+      rss_pages = 0;
+    fclose (statm);
+  }
+
+  pty_metrics_head (fp, "vtach_resident_bytes", "gauge", "Resident set size of the master.");
+  pty_metrics_sample (this, fp, "vtach_resident_bytes");
+  fprintf (fp, "} %ld\n", rss_pages * sysconf (_SC_PAGESIZE));
+
+  pty_metrics_head (fp, "vtach_session_output_bytes_total", "counter", "Bytes of output of the session.");
+  for (struct session *sess = $my(sessions); sess; sess = sess->next) {
+    pty_metrics_sample (this, fp, "vtach_session_output_bytes_total");
+    pty_metrics_label (fp, "session", (sess->name ? sess->name : ""));
+    fprintf (fp, "} %" PRIu64 "\n", sess->out_seq);
+  }
+
+  pty_metrics_head (fp, "vtach_session_attached_clients", "gauge", "Clients attached to the session.");
+  for (struct session *sess = $my(sessions); sess; sess = sess->next) {
+    pty_metrics_sample (this, fp, "vtach_session_attached_clients");
+    pty_metrics_label (fp, "session", (sess->name ? sess->name : ""));
+    fprintf (fp, "} %d\n", sess->num_attached);
+  }
+
+  pty_metrics_head (fp, "vtach_client_queue_bytes", "gauge", "Output queued for the client.");
+  for (struct client *p = $my(clients); p; p = p->next) {
+    if (p->is_dead) continue;
+
+    size_t queued = p->q_len;
+    if (p->ring)
+      queued += (size_t) (atomic_load (&p->ring->head) - atomic_load (&p->ring->tail));
+
+    char client[16];
+    snprintf (client, sizeof (client), "%d", p->fd);
+
+    pty_metrics_sample (this, fp, "vtach_client_queue_bytes");
+    pty_metrics_label (fp, "session", (p->session and p->session->name ? p->session->name : ""));
+    pty_metrics_label (fp, "client", client);
+    fprintf (fp, "} %zu\n", queued);
+  }
+
+  if ($my(integrated) and 0 is $my(is_daemon))
+    pty_metrics_write_vwm (this, fp);
+
+  if (0 is fclose (fp))
+    rename (tmp, $my(metrics).fname);
+  else
+    unlink (tmp);
+}
+
+private void pty_metrics_unlink (void) {
+  if (getpid () is metrics_pid)
+    unlink (metrics_fname);
+}
+
+private void pty_metrics_init (vtach_t *this) {
+  vwm_t *vwm = $my(objects)[VWM_OBJECT];
+
+  char *base = strrchr ($my(sockname), '/');
+  base = (NULL is base ? $my(sockname) : base + 1);
+
+  /* next to the temporary directory of the process, that goes with it */
+  char *tmpdir = Vwm.get.tmpdir (vwm);
+  char *sp = strrchr (tmpdir, '/');
+  int tmpdir_len = (NULL is sp or sp is tmpdir ? (int) bytelen (tmpdir) : (int) (sp - tmpdir));
+
+  snprintf ($my(metrics).fname, sizeof ($my(metrics).fname), "%.*s/vtach_%s.prom",
+      tmpdir_len, tmpdir, base);
 
-    int retval = $my(exec_child_cb) (this, argc, argv);
-    __deinit_vwm__ (&vwm);
-    __deinit_vtach__ (&this);
+  $my(metrics).ep_kind = EP_METRICS;
+  $my(metrics).fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  if ($my(metrics).fd is -1) return;
 
-    _exit (retval);
+  struct itimerspec its = {
+    .it_interval = {.tv_sec = $my(metrics).interval},
+    .it_value = {.tv_sec = $my(metrics).interval}};
+
+  if (-1 is timerfd_settime ($my(metrics).fd, 0, &its, NULL) or
+      -1 is pty_epoll_add (this, $my(metrics).fd, EPOLLIN, &$my(metrics))) {
+    close ($my(metrics).fd);
+    $my(metrics).fd = -1;
+    return;
   }
 
-  return 0;
-}
+  metrics_pid = getpid ();
+  metrics_fname = $my(metrics).fname;
+  atexit (pty_metrics_unlink);
 
-private void killpty (struct pty *pty, int sig) {
-  pid_t pgrp = -1;
+  pty_metrics_write (this);
+}
 
-#ifdef TIOCSIGNAL
-  if (ioctl (pty->fd, TIOCSIGNAL, sig) >= 0)
-    return;
+private void pty_daemonize (vtach_t *this, int statusfd) {
+  signal (SIGPIPE, SIG_IGN);
+  signal (SIGXFSZ, SIG_IGN);
+  signal (SIGHUP, SIG_IGN);
+  signal (SIGTTIN, SIG_IGN);
+  signal (SIGTTOU, SIG_IGN);
+  signal (SIGINT, pty_die);
+  signal (SIGTERM, pty_die);
+#ifdef VWM_TRACE
+  signal (SIGUSR2, vtach_trace_signal);
 #endif
 
-#ifdef TIOCSIG
-  if (ioctl (pty->fd, TIOCSIG, sig) >= 0)
-    return;
-#endif
+  /* Close statusfd, since we don't need it anymore. */
+  if (statusfd isnot -1) close (statusfd);
 
-#ifdef TIOCGPGRP
-  if (ioctl (pty->fd, TIOCGPGRP, &pgrp) >= 0 and pgrp isnot -1 and
-    kill (-pgrp, sig) >= 0)
-    return;
-#endif
+  /* Make sure stdin/stdout/stderr point to /dev/null. We are now a
+  ** daemon. */
+  int nullfd = open ("/dev/null", O_RDWR);
+  dup2 (nullfd, 0);
+  dup2 (nullfd, 1);
+  dup2 (nullfd, 2);
 
-  /* Fallback using the child's pid. */
-  kill (-pty->pid, sig);
-}
+  if (nullfd > 2)
+    close (nullfd);
 
-private void pty_activity (vtach_t *this, int s) {
-  unsigned char buf[BUFSIZE];
-  ssize_t len;
-  struct client *p;
-  fd_set readfds, writefds;
-  int max_fd, nclients;
+  /* Every descriptor is registered once; nothing is rebuilt per iteration
+  ** and an idle master just sleeps in epoll_wait(). */
+  $my(epfd) = epoll_create1 (EPOLL_CLOEXEC);
+  $my(has_dead_clients) = 0;
 
-  len = read ($my(pty).fd, buf, sizeof (buf));
-  if (len <= 0)
+  if ($my(epfd) is -1 or
+      -1 is pty_epoll_add (this, $my(sock_fd), EPOLLIN|EPOLLET, NULL)) {
+    unlink ($my(sockname));
     exit (1);
+  }
 
-  if (tcgetattr ($my(pty).fd, &$my(pty).term) < 0)
-    exit (1);
+  if ($my(metrics).interval > 0)
+    pty_metrics_init (this);
+}
 
-top:
-  FD_ZERO(&readfds);
-  FD_ZERO(&writefds);
-  FD_SET(s, &readfds);
-  max_fd = s;
+private void pty_poll (vtach_t *this, int timeout) {
+  struct epoll_event events[PTY_MAX_EVENTS];
 
-  for (p = $my(clients), nclients = 0; p; p = p->next) {
-    if (!p->attached)
-      continue;
+  VWM_TRACE_BEGIN ("epoll_wait");
+  int n = epoll_wait ($my(epfd), events, PTY_MAX_EVENTS, timeout);
+  VWM_TRACE_END ("epoll_wait");
 
-    FD_SET(p->fd, &writefds);
-    if (p->fd > max_fd)
-      max_fd = p->fd;
+#ifdef VWM_TRACE
+  vtach_trace_check (this);
+#endif
 
-    nclients++;
-  }
+  if (n < 0) {
+    if (errno is EINTR)
+      return;
 
-  ifnot (nclients) return;
+    unlink ($my(sockname));
+    exit (1);
+  }
 
-  if (select (max_fd + 1, &readfds, &writefds, NULL, NULL) < 0)
-    return;
+  VWM_TRACE_BEGIN ("dispatch");
 
-  for (p = $my(clients), nclients = 0; p; p = p->next) {
-    ssize_t written;
+  for (int i = 0; i < n; i++) {
+    void *ptr = events[i].data.ptr;
 
-    ifnot (FD_ISSET(p->fd, &writefds))
+    /* New client? */
+    if (NULL is ptr) {
+      pty_socket_activity (this, $my(sock_fd));
       continue;
+    }
 
-    written = 0;
-    while (written < len) {
-      ssize_t n = write (p->fd, buf + written, len - written);
+    /* A shared memory client made room in its ring. */
+    if (*(int *) ptr is EP_SHM) {
+      struct client *p = ((struct shm_link *) ptr)->client;
+      eventfd_t val;
+      eventfd_read (p->space_efd, &val);
 
-      if (n > 0) {
-        written += n;
-        continue;
-      } else if (n < 0 and errno is EINTR)
-        continue;
-      else if (n < 0 and errno isnot EAGAIN)
-        nclients = -1;
-      break;
+      ifnot (p->is_dead)
+        pty_client_flush (this, p);
+      continue;
     }
 
-    if (nclients isnot -1 and written is len)
-      nclients++;
-  }
+    /* reap the sessions that have exited */
+    if (*(int *) ptr is EP_SIGCHLD) {
+      char buf[64];
+      while (0 < read ($my(sigchld).fd[0], buf, sizeof (buf)));
+      while (waitpid (-1, NULL, WNOHANG) > 0);
+      continue;
+    }
 
-  /* Try again if nothing happened. */
-  if (!FD_ISSET(s, &readfds) and nclients is 0)
-    goto top;
-}
+    if (*(int *) ptr is EP_METRICS) {
+      uint64_t expirations;
+      if (sizeof (expirations) is read ($my(metrics).fd, &expirations, sizeof (expirations)))
+        pty_metrics_write (this);
+      continue;
+    }
 
-private void pty_socket_activity (vtach_t *this, int s) {
-  int fd = accept (s, NULL, NULL);
-  if (fd < 0)
-    return;
+    if (*(int *) ptr is EP_SESSION) {
+      struct session *sess = ptr;
 
-  if (fd_set_nonblocking (fd) < 0) {
-    close (fd);
-    return;
-  }
+      if (0 is sess->is_dead and (events[i].events & EPOLLOUT))
+        pty_session_input_flush (this, sess);
 
-  struct client *p = Alloc (sizeof (struct client));
+      if (0 is sess->is_dead and 0 is $my(integrated) and
+          (events[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR)))
+        pty_activity (this, sess);
+      continue;
+    }
 
-  p->fd = fd;
-  p->attached = 0;
-  p->pprev = &$my(clients);
-  p->next = *(p->pprev);
-  if (p->next)
-    p->next->pprev = &p->next;
-  *(p->pprev) = p;
-}
+    struct client *p = ptr;
 
-private void pty_client_activity (vtach_t *this, struct client *p) {
-  struct packet pkt;
+    if (p->is_dead)
+      continue;
 
-  ssize_t len = read (p->fd, &pkt, sizeof (struct packet));
-  if (len < 0 and (errno is EAGAIN or errno is EINTR))
-    return;
+    if (events[i].events & EPOLLOUT)
+      pty_client_flush (this, p);
 
-  if (len <= 0) {
-    close (p->fd);
+    if (p->is_dead)
+      continue;
 
-    if (p->next)
-      p->next->pprev = p->pprev;
-    *(p->pprev) = p->next;
-    free(p);
-    return;
+    if (events[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR))
+      pty_client_activity (this, p);
   }
 
-  /* Push out data to the program. */
-  if (pkt.type is MSG_PUSH) {
-    if (pkt.len <= sizeof (pkt.u.buf))
-      write ($my(pty).fd, pkt.u.buf, pkt.len);
-  } else if (pkt.type is MSG_ATTACH)
-    p->attached = 1;
-  else if (pkt.type is MSG_DETACH)
-    p->attached = 0;
-  else if (pkt.type is MSG_WINCH) {
-    $my(pty).ws = pkt.u.ws;
-    ioctl ($my(pty).fd, TIOCSWINSZ, &$my(pty).ws);
-  } else if (pkt.type == MSG_REDRAW) {
-    int method = pkt.len;
-
-    /* If the client didn't specify a particular method, use
-    ** whatever we had on startup. */
-    if (method is REDRAW_UNSPEC)
-      method = $my(redraw_method);
-    if (method is REDRAW_NONE)
-      return;
-
-    $my(pty).ws = pkt.u.ws;
-    ioctl ($my(pty).fd, TIOCSWINSZ, &$my(pty).ws);
+  pty_release_dead_clients (this);
 
-    /* Send a ^L character if the terminal is in no-echo and
-    ** character-at-a-time mode. */
-    if (method is REDRAW_CTRL_L) {
-      char c = '\f';
+  VWM_TRACE_END ("dispatch");
+}
 
-      if ((($my(pty).term.c_lflag & (ECHO|ICANON)) is 0) and
-           ($my(pty).term.c_cc[VMIN] is 0))
-           //($my(pty).term.c_cc[VMIN] is 1)) {
-        write ($my(pty).fd, &c, 1);
-    } else if (method is REDRAW_WINCH)
-      killpty (&$my(pty), SIGWINCH);
-  }
+private void pty_loop (vtach_t *this) {
+  while (1)
+    pty_poll (this, -1);
 }
 
 private void pty_process (vtach_t *this, int s, int argc, char **argv, int statusfd) {
@@ -622,7 +2592,14 @@ private void pty_process (vtach_t *this, int s, int argc, char **argv, int statu
 
   signal (SIGCHLD, pty_die);
 
-  if (pty_child (this, argc, argv) < 0) {
+  $my(sock_fd) = s;
+  $my(is_daemon) = 0;
+
+  struct session *sess = Alloc (sizeof (struct session));
+  sess->ep_kind = EP_SESSION;
+  sess->waitattach = $my(waitattach);
+
+  if (pty_child (this, sess, argc, argv) < 0) {
     if (statusfd isnot -1)
       dup2 (statusfd, 1);
 
@@ -635,100 +2612,137 @@ private void pty_process (vtach_t *this, int s, int argc, char **argv, int statu
     exit (1);
   }
 
-  signal (SIGPIPE, SIG_IGN);
-  signal (SIGXFSZ, SIG_IGN);
-  signal (SIGHUP, SIG_IGN);
-  signal (SIGTTIN, SIG_IGN);
-  signal (SIGTTOU, SIG_IGN);
-  signal (SIGINT, pty_die);
-  signal (SIGTERM, pty_die);
+  $my(sessions) = sess;
+  sess->pprev = &$my(sessions);
 
-  /* Close statusfd, since we don't need it anymore. */
-  if (statusfd isnot -1) close (statusfd);
+  pty_daemonize (this, statusfd);
 
-  /* Make sure stdin/stdout/stderr point to /dev/null. We are now a
-  ** daemon. */
-  int nullfd = open ("/dev/null", O_RDWR);
-  dup2 (nullfd, 0);
-  dup2 (nullfd, 1);
-  dup2 (nullfd, 2);
+  if (fd_set_nonblocking (sess->pty.fd) is NOTOK) {
+    unlink ($my(sockname));
+    exit (1);
+  }
 
-  if (nullfd > 2)
-    close (nullfd);
+  ifnot (sess->waitattach)
+    pty_epoll_add (this, sess->pty.fd, EPOLLIN|EPOLLET, sess);
 
-  struct client *p, *next;
-  fd_set readfds;
-  int
-    max_fd,
-    has_attached_client = 0;
+  pty_loop (this);
+}
 
-  while (1) {
-    int new_has_attached_client = 0;
+private void pty_integrated_output (vwm_t *vwm, char *buf, size_t len) {
+  vtach_t *this = vwm->self.get.object (vwm, VTACH_OBJECT);
+  struct session *sess = $my(sessions);
 
-    FD_ZERO(&readfds);
-    FD_SET(s, &readfds);
-    max_fd = s;
+  pty_session_record (sess, buf, len);
 
-    /* When waitattach is set, wait until the client attaches
-     * before trying to read from the pty. */
-    if ($my(waitattach)) {
-      if ($my(clients) and $my(clients)->attached)
-        $my(waitattach) = 0;
-    } else {
-      FD_SET($my(pty).fd, &readfds);
-      if ($my(pty).fd > max_fd)
-        max_fd = $my(pty).fd;
-    }
+  struct client *p;
+  for (p = $my(clients); p; p = p->next) {
+    if (p->session isnot sess or 0 is p->attached)
+      continue;
 
-    for (p = $my(clients); p; p = p->next) {
-      FD_SET(p->fd, &readfds);
-      if (p->fd > max_fd)
-        max_fd = p->fd;
+    pty_client_write (this, p, buf, len);
+  }
 
-      if (p->attached)
-        new_has_attached_client = 1;
+  /* As with a blocking write to the terminal, the renderer waits for
+  ** the slow clients, and so do the frames that feed it. A client that
+  ** doesn't take anything for CLIENT_MAX_STALL is dropped (it might
+  ** resume), and one that sends something, say that it detaches, is
+  ** left to the loop. */
+  while (sess->pty_throttled) {
+    if (NULL is (p = pty_session_slow_client (this, sess))) {
+      sess->pty_throttled = 0;
+      break;
     }
 
-    /* chmod the socket if necessary. */
-    if (has_attached_client isnot new_has_attached_client) {
-      update_socket_modes ($my(sockname), new_has_attached_client);
-      has_attached_client = new_has_attached_client;
-    }
+    struct pollfd pfd[2];
+    pfd[0].fd = p->fd;
+    pfd[0].events = POLLIN|(p->ring ? 0 : POLLOUT);
+    pfd[1].fd = p->space_efd;
+    pfd[1].events = POLLIN;
 
-    if (select (max_fd + 1, &readfds, NULL, NULL, NULL) < 0) {
-      if (errno is EINTR or errno isnot EAGAIN)
-        continue;
+    int n = poll (pfd, (p->ring ? 2 : 1), CLIENT_MAX_STALL);
 
-      unlink ($my(sockname));
-      exit (1);
+    if (n is -1 and errno is EINTR)
+      continue;
+
+    if (n <= 0) {
+      pty_client_kill (this, p);
+      continue;
     }
 
-    /* New client? */
-    if (FD_ISSET(s, &readfds))
-      pty_socket_activity (this, s);
+    if (pfd[0].revents & (POLLIN|POLLHUP|POLLERR))
+      break;
 
-    for (p = $my(clients); p; p = next) {
-      next = p->next;
-      if (FD_ISSET(p->fd, &readfds))
-        pty_client_activity (this, p);
+    if (p->ring) {
+      eventfd_t val;
+      eventfd_read (p->space_efd, &val);
     }
 
-    if (FD_ISSET($my(pty).fd, &readfds))
-      pty_activity (this, s);
+    pty_client_flush (this, p);
   }
 }
 
-private int vtach_pty_main (vtach_t *this, int argc, char **argv) {
-  int s = self(sock.create, $my(sockname));
+private void pty_integrated_poll (vwm_t *vwm, int fd) {
+  (void) fd;
+  vtach_t *this = vwm->self.get.object (vwm, VTACH_OBJECT);
+  pty_poll (this, 0);
+}
 
-  if (s is NOTOK) {
+/* The master runs vwm itself, so there is no pty and no process between
+** them: the rendered output goes to the clients, and their keystrokes
+** come in through a pipe, in place of the standard input. */
+private void pty_integrated (vtach_t *this, int s, int statusfd) {
+  setsid ();
+
+  vwm_t *vwm = $my(objects)[VWM_OBJECT];
+
+  $my(sock_fd) = s;
+  $my(is_daemon) = 0;
+
+  struct session *sess = Alloc (sizeof (struct session));
+  sess->ep_kind = EP_SESSION;
+  sess->pty.fd = -1;
+  sess->pty.pid = getpid ();
+  sess->pty.ws.ws_row = Vwm.get.lines (vwm);
+  sess->pty.ws.ws_col = Vwm.get.columns (vwm);
+
+  $my(sessions) = sess;
+  sess->pprev = &$my(sessions);
+
+  pty_daemonize (this, statusfd);
+
+  int fds[2];
+  if (-1 is pipe (fds)) {
+    unlink ($my(sockname));
+    exit (1);
+  }
+
+  dup2 (fds[0], STDIN_FILENO);
+  close (fds[0]);
+
+  $my(input_fd) = fds[1];
+  fcntl ($my(input_fd), F_SETFD, FD_CLOEXEC);
+  fd_set_nonblocking ($my(input_fd));
+
+  Vwm.set.output_cb (vwm, pty_integrated_output);
+  Vwm.set.extern_fd (vwm, $my(epfd), pty_integrated_poll);
+
+  int retval = Vwm.main (vwm);
+
+  pty_save_snapshot (this, vwm);
+
+  unlink ($my(sockname));
+  exit (retval is OK ? 0 : 1);
+}
+
+private int pty_socket_prepare (vtach_t *this, int *s, int *fd) {
+  *s = self(sock.create, $my(sockname));
+
+  if (*s is NOTOK) {
     fprintf (stderr, "a%s: %s\n", $my(sockname), strerror (errno));
     return NOTOK;
   }
 
-  fcntl (s, F_SETFD, FD_CLOEXEC);
-
-  int fd[2] = {-1, -1};
+  fcntl (*s, F_SETFD, FD_CLOEXEC);
 
   /* If FD_CLOEXEC works, create a pipe and use it to report any errors
   ** that occur while trying to execute the program. */
@@ -743,9 +2757,23 @@ private int vtach_pty_main (vtach_t *this, int argc, char **argv) {
 
   int rows; int cols;
   self(init.term, &rows, &cols);
+  return OK;
+}
+
+private int vtach_pty_main (vtach_t *this, int argc, char **argv) {
+  int s;
+  int fd[2] = {-1, -1};
+
+  if (NOTOK is pty_socket_prepare (this, &s, fd))
+    return NOTOK;
 
-  int retval;
-  if (OK isnot (retval = $my(pty_main_cb) (this, argc, argv))) {
+  vwm_t *vwm = $my(objects)[VWM_OBJECT];
+
+  int retval = NOTOK;
+  if (NULL isnot $my(snapshot) and 0 is access ($my(snapshot), F_OK))
+    retval = Vwm.restore_snapshot (vwm, $my(snapshot));
+
+  if (OK isnot retval and OK isnot (retval = $my(pty_main_cb) (this, argc, argv))) {
     unlink ($my(sockname));
     close (s);
     return retval;
@@ -761,6 +2789,9 @@ private int vtach_pty_main (vtach_t *this, int argc, char **argv) {
     if (fd[0] != -1)
       close (fd[0]);
 
+    if ($my(integrated))
+      pty_integrated (this, s, fd[1]);
+
     pty_process (this, s, argc, argv, fd[1]);
 
     return 0;
@@ -771,6 +2802,80 @@ private int vtach_pty_main (vtach_t *this, int argc, char **argv) {
   return 0;
 }
 
+/* Starts a master that hosts many named sessions behind $my(sockname).
+** Sessions are created on demand by the first MSG_OPEN for a name, and
+** the windows of each one are set up by pty_main_cb in the session child. */
+private int vtach_daemon_main (vtach_t *this) {
+  int s;
+  int fd[2] = {-1, -1};
+
+  if (NOTOK is pty_socket_prepare (this, &s, fd))
+    return NOTOK;
+
+  pid_t pid = fork ();
+
+  if (pid < 0) {
+    fprintf (stderr, "fork: %s\n", strerror (errno));
+    unlink ($my(sockname));
+  } else if (pid is 0) {
+    if (fd[0] != -1)
+      close (fd[0]);
+
+    setsid ();
+
+    $my(sock_fd) = s;
+    $my(is_daemon) = 1;
+
+    pty_daemonize (this, fd[1]);
+
+    $my(sigchld).ep_kind = EP_SIGCHLD;
+    if (-1 is pipe2 ($my(sigchld).fd, O_NONBLOCK|O_CLOEXEC) or
+        -1 is pty_epoll_add (this, $my(sigchld).fd[0], EPOLLIN, &$my(sigchld))) {
+      unlink ($my(sockname));
+      exit (1);
+    }
+
+    sigchld_wfd = $my(sigchld).fd[1];
+    signal (SIGCHLD, pty_sigchld);
+
+    pty_loop (this);
+
+    return 0;
+  }
+
+  if (fd[1] != -1) close (fd[1]);
+  if (fd[0] != -1) close (fd[0]);
+
+  close (s);
+
+  return 0;
+}
+
+private int vtach_daemon_list (vtach_t *this, FILE *fp) {
+  int s = self(sock.connect, $my(sockname));
+  if (s is NOTOK)
+    return NOTOK;
+
+  struct packet pkt;
+  memset (&pkt, 0, sizeof (struct packet));
+  pkt.type = MSG_LIST;
+
+  if (-1 is write (s, &pkt, sizeof (struct packet))) {
+    close (s);
+    return NOTOK;
+  }
+
+  char buf[BUFSIZE];
+  ssize_t len;
+
+  while ((len = read (s, buf, sizeof (buf))) > 0)
+    fwrite (buf, 1, len, fp);
+
+  fflush (fp);
+  close (s);
+  return (len is 0 ? OK : NOTOK);
+}
+
 private vwm_term *vtach_init_term (vtach_t *this, int *rows, int *cols) {
   vwm_t *vwm = $my(objects)[VWM_OBJECT];
 
@@ -866,6 +2971,49 @@ static void vtach_set_at_exit_cb (vtach_t *this, PtyAtExit_cb cb) {
   $my(at_exit_cbs)[$my(num_at_exit_cbs) -1] = cb;
 }
 
+private void vtach_set_session (vtach_t *this, char *name, int argc, char **argv) {
+  $my(session_name) = name;
+  $my(session_argc) = argc;
+  $my(session_argv) = argv;
+}
+
+private void vtach_set_transport (vtach_t *this, int transport) {
+  $my(transport) = transport;
+}
+
+private void vtach_set_resume (vtach_t *this, int resume) {
+  $my(resume) = resume;
+}
+
+private void vtach_set_integrated (vtach_t *this, int integrated) {
+  $my(integrated) = integrated;
+}
+
+private void vtach_set_metrics (vtach_t *this, int interval) {
+  $my(metrics).interval = interval;
+}
+
+private void vtach_set_snapshot (vtach_t *this, char *fname) {
+  free ($my(snapshot));
+  $my(snapshot) = NULL;
+
+  if (NULL is fname) return;
+
+  /* the restored frames might change the current directory */
+  if (fname[0] is '/') {
+    $my(snapshot) = strdup (fname);
+    return;
+  }
+
+  char *cwd = getcwd (NULL, 0);
+  if (NULL is cwd) return;
+
+  size_t len = bytelen (cwd) + bytelen (fname) + 2;
+  $my(snapshot) = Alloc (len);
+  snprintf ($my(snapshot), len, "%s/%s", cwd, fname);
+  free (cwd);
+}
+
 private vwm_term *vtach_get_term (vtach_t *this) {
   return $my(term);
 }
@@ -893,6 +3041,12 @@ public vtach_t *__init_vtach__ (vwm_t *vwm) {
     .set = (vtach_set_self) {
       .object = vtach_set_object,
       .at_exit_cb = vtach_set_at_exit_cb,
+      .session = vtach_set_session,
+      .transport = vtach_set_transport,
+      .resume = vtach_set_resume,
+      .integrated = vtach_set_integrated,
+      .snapshot = vtach_set_snapshot,
+      .metrics = vtach_set_metrics,
       .pty_main_cb = vtach_set_pty_main_cb,
       .exec_child_cb = vtach_set_exec_child_cb
     },
@@ -916,6 +3070,10 @@ public vtach_t *__init_vtach__ (vwm_t *vwm) {
     },
     .tty = (vtach_tty_self) {
       .main = vtach_tty_main
+    },
+    .daemon = (vtach_daemon_self) {
+      .main = vtach_daemon_main,
+      .list = vtach_daemon_list
     }
   };
 
@@ -944,6 +3102,8 @@ public void __deinit_vtach__ (vtach_t **thisp) {
   if ($my(num_at_exit_cbs))
     free ($my(at_exit_cbs));
 
+  free ($my(snapshot));
+
   free (this->prop);
   free (this);
   *thisp = NULL;
@@ -7,6 +7,15 @@ enum {
   MSG_DETACH  = 2,
   MSG_WINCH   = 3,
   MSG_REDRAW  = 4,
+  MSG_OPEN    = 5,
+  MSG_LIST    = 6,
+  MSG_SHM     = 7,
+  MSG_RESUME  = 8,
+};
+
+enum {
+  VTACH_TRANSPORT_SOCKET = 0,
+  VTACH_TRANSPORT_SHM    = 1,
 };
 
 typedef struct vtach_t vtach_t;
@@ -21,7 +30,13 @@ typedef struct vtach_set_self {
     (*object) (vtach_t *, void *, int),
     (*at_exit_cb) (vtach_t *, PtyAtExit_cb),
     (*pty_main_cb) (vtach_t *, PtyMain_cb),
-    (*exec_child_cb) (vtach_t *, PtyOnExecChild_cb);
+    (*exec_child_cb) (vtach_t *, PtyOnExecChild_cb),
+    (*session) (vtach_t *, char *, int, char **),
+    (*transport) (vtach_t *, int),
+    (*resume) (vtach_t *, int),
+    (*integrated) (vtach_t *, int),
+    (*metrics) (vtach_t *, int),
+    (*snapshot) (vtach_t *, char *);
 } vtach_set_self;
 
 typedef struct vtach_get_self {
@@ -56,6 +71,12 @@ typedef struct vtach_tty_self {
   int (*main) (vtach_t *this);
 } vtach_tty_self;
 
+typedef struct vtach_daemon_self {
+  int
+    (*main) (vtach_t *this),
+    (*list) (vtach_t *this, FILE *);
+} vtach_daemon_self;
+
 typedef struct vtach_self {
   vtach_set_self  set;
   vtach_get_self  get;
@@ -63,6 +84,7 @@ typedef struct vtach_self {
   vtach_tty_self  tty;
   vtach_sock_self sock;
   vtach_init_self init;
+  vtach_daemon_self daemon;
 } vtach_self;
 
 typedef struct vtach_t {
@@ -4,8 +4,11 @@
  * The only addition is MODKEY-CTRL(D) which simply detachs the application.
  */
 
+#define _DEFAULT_SOURCE
+
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/types.h>
@@ -23,9 +26,18 @@ static const char usage[] =
   "\n"
   "Options:\n"
   "    -s, --sockname=     set the socket name [required]\n"
-  "    -a, --attach        attach to the specified socket\n";
-
-private char **set_argv (int *argc, char **argv, char **sockname, int *attach) {
+  "    -a, --attach        attach to the specified socket\n"
+  "        --session=      open (or create) a session in the daemon at the socket\n"
+  "        --list          list the sessions of the daemon at the socket\n"
+  "        --shm           receive the output through shared memory\n"
+  "        --resume        reconnect and resume the output, when the socket is lost\n"
+  "        --integrated    run the windows in the master, without an inner pty\n"
+  "        --pool=         keep that many shells started ahead, for new frames\n"
+  "        --snapshot=     restore the windows from file, and save them there at quit\n"
+  "        --metrics=      write the counters to the temporary directory, every that many seconds\n";
+
+private char **set_argv (int *argc, char **argv, char **sockname, int *attach,
+                        char **session, int *list, int *shm, int *resume, int *integrated, int *pool, char **snapshot, int *metrics) {
   argv++; *argc -= 1;
 
   char **largv = argv;
@@ -65,6 +77,62 @@ private char **set_argv (int *argc, char **argv, char **sockname, int *attach) {
       continue;
     }
 
+    if (0 == strncmp (argv[i], "--session=", 10)) {
+      char *sp = strchr (argv[i], '=') + 1;
+      ifnot (*sp)
+        continue;
+
+      *session = sp;
+      largv++;
+      continue;
+    }
+
+    if (0 == strncmp (argv[i], "--snapshot=", 11)) {
+      char *sp = strchr (argv[i], '=') + 1;
+      ifnot (*sp)
+        continue;
+
+      *snapshot = sp;
+      largv++;
+      continue;
+    }
+
+    if (0 == strncmp (argv[i], "--metrics=", 10)) {
+      *metrics = atoi (argv[i] + 10);
+      largv++;
+      continue;
+    }
+
+    if (0 == strncmp (argv[i], "--pool=", 7)) {
+      *pool = atoi (argv[i] + 7);
+      largv++;
+      continue;
+    }
+
+    if (0 == strcmp (argv[i], "--integrated")) {
+      *integrated = 1;
+      largv++;
+      continue;
+    }
+
+    if (0 == strcmp (argv[i], "--resume")) {
+      *resume = 1;
+      largv++;
+      continue;
+    }
+
+    if (0 == strcmp (argv[i], "--shm")) {
+      *shm = 1;
+      largv++;
+      continue;
+    }
+
+    if (0 == strcmp (argv[i], "--list")) {
+      *list = 1;
+      largv++;
+      continue;
+    }
+
     if (0 == strcmp (argv[i], "-a") or
         0 == strcmp (argv[i], "--attach")) {
       *attach = 1;
@@ -85,10 +153,19 @@ int main (int argc, char **argv) {
 
   int
     retval = 1,
-    attach = 0;
-  char *sockname = NULL;
-
-  argv = set_argv (&argc, argv, &sockname, &attach);
+    attach = 0,
+    list = 0,
+    shm = 0,
+    resume = 0,
+    integrated = 0,
+    pool = 0,
+    metrics = 0;
+  char
+    *sockname = NULL,
+    *session = NULL,
+    *snapshot = NULL;
+
+  argv = set_argv (&argc, argv, &sockname, &attach, &session, &list, &shm, &resume, &integrated, &pool, &snapshot, &metrics);
 
   if (argc < 0) goto theend;
 
@@ -101,6 +178,54 @@ int main (int argc, char **argv) {
   if (NOTOK is Vtach.init.pty (vtach, sockname))
     goto theend;
 
+  if (list) {
+    retval = (OK is Vtach.daemon.list (vtach, stdout) ? 0 : 1);
+    goto theend;
+  }
+
+  if (shm)
+    Vtach.set.transport (vtach, VTACH_TRANSPORT_SHM);
+
+  if (resume)
+    Vtach.set.resume (vtach, 1);
+
+  if (integrated)
+    Vtach.set.integrated (vtach, 1);
+
+  if (pool)
+    this->self.set.pool (this, pool);
+
+  if (snapshot)
+    Vtach.set.snapshot (vtach, snapshot);
+
+  if (metrics > 0)
+    Vtach.set.metrics (vtach, metrics);
+
+  if (session) {
+    /* start the daemon, unless it is already there */
+    int s = Vtach.sock.connect (vtach, sockname);
+    if (NOTOK is s) {
+      /* remove only a stale socket, never something else by that name */
+      struct stat st;
+      if (0 is lstat (sockname, &st)) {
+        ifnot (S_ISSOCK(st.st_mode)) {
+          fprintf (stderr, "%s: is not a socket\n", sockname);
+          goto theend;
+        }
+
+        unlink (sockname);
+      }
+
+      if (NOTOK is Vtach.daemon.main (vtach))
+        goto theend;
+    } else
+      close (s);
+
+    Vtach.set.session (vtach, session, argc, argv);
+    retval = Vtach.tty.main (vtach);
+    goto theend;
+  }
+
   ifnot (attach)
     retval = Vtach.pty.main (vtach, argc, argv);
 
@@ -59,6 +59,10 @@
 #define bytelen strlen
 #endif
 
+#ifndef unlikely
+#define unlikely(__expr__) __builtin_expect (!!(__expr__), 0)
+#endif
+
 
 #define INDEX_ERROR            -1000
 #define INTEGEROVERFLOW_ERROR  -1002
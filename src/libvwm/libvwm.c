@@ -1,5 +1,4 @@
-#define _XOPEN_SOURCE 700
-#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 
 #include <stdint.h>
 #include <stdio.h>
@@ -19,8 +18,13 @@
 #include <time.h>
 #include <dirent.h>
 #include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
 
 #include <errno.h>
+#include <limits.h>
 
 #include <libv/libvwm.h>
 #include "__libvwm.h"
@@ -57,6 +61,10 @@ static vwm_t *VWM;
 
 #define MIN_ROWS 2
 #define MAX_TTYNAME 1024
+
+#ifndef VWM_POOL_MAX
+#define VWM_POOL_MAX 8
+#endif
 #define MAX_PARAMS  12
 #define MAX_SEQ_LEN 32
 
@@ -67,13 +75,6 @@ static vwm_t *VWM;
 #define isnotutf8(c_)   (IS_UTF8 (c_) == 0)
 #define isnotatty(fd_)  (0 == isatty ((fd_)))
 
-#define V_STR_FMT_LEN(len_, fmt_, ...)                                      \
-({                                                                    \
-  char buf_[len_];                                                    \
-  snprintf (buf_, len_, fmt_, __VA_ARGS__);                           \
-  buf_;                                                               \
-})
-
 #define NORMAL          0x00
 #define BOLD            0x01
 #define UNDERLINE       0x02
@@ -113,7 +114,7 @@ static vwm_t *VWM;
 #define TERM_AUTOWRAP_OFF           "\033[?7l"
 #define TERM_AUTOWRAP_OFF_LEN       5
 
-#define TERM_SEND_ESC_SEQ(seq) fd_write (this->out_fd, seq, seq ## _LEN)
+#define TERM_SEND_ESC_SEQ(seq) term_write (this, seq, seq ## _LEN)
 
 #define COLOR_FG_NORMAL   39
 
@@ -157,8 +158,120 @@ struct tmpname_t {
 
 typedef string_t *(*FrameProcessChar_cb) (vwm_frame *, string_t *, int);
 
+/* A pty with default_app already running on it, waiting for a frame. */
+typedef struct pool_pty {
+  int fd;
+  pid_t pid;
+  char tty_name[MAX_TTYNAME];
+} pool_pty;
+
+/* Threads that spawn the processes of a new window at once. */
+#define VWM_SPAWN_THREADS 4
+
+/* Milliseconds over which the SIGWINCH signals are coalesced. */
+#define VWM_RESIZE_DELAY 50
+
+/* posix_spawn_file_actions_addchdir_np(), for frames with a cwd */
+#if defined (__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define HAVE_SPAWN_CHDIR 1
+#else
+#define HAVE_SPAWN_CHDIR 0
+#endif
+
+/* The snapshot file: a header, the cwd and then every window followed
+** by its frames.  Each record and each string is padded to 8 bytes, so
+** a mapped file can be read in place.  The grid of a frame is stored as
+** grid_rows rows of videomem cells and then as many rows of colors. */
+#define SNAPSHOT_MAGIC     "VWMSNAP"
+#define SNAPSHOT_VERSION   1
+#define SNAPSHOT_BYTEORDER 0x01020304
+#define SNAPSHOT_ALIGN(n)  (((n) + 7) & ~((size_t) 7))
+
+typedef struct snap_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t num_rows;
+  uint32_t num_cols;
+  uint32_t num_wins;
+  uint32_t cur_win_idx;
+  uint32_t cwd_len;
+  uint32_t flags;
+} snap_header;
+
+typedef struct snap_win {
+  uint32_t num_frames;
+  uint32_t max_frames;
+  uint32_t cur_frame_idx;
+  uint32_t name_len;
+} snap_win;
+
+typedef struct snap_frame {
+  int32_t
+    num_rows,
+    num_cols,
+    first_row,
+    last_row,
+    row_pos,
+    col_pos,
+    saved_row_pos,
+    saved_col_pos,
+    scroll_first_row,
+    key_state,
+    is_visible,
+    remove_log;
+
+  uint8_t
+    charset[2],
+    textattr,
+    saved_textattr;
+
+  uint32_t
+    argc,
+    argv_len,
+    cwd_len,
+    logfile_len,
+    grid_rows,
+    grid_cols;
+
+  uint64_t log_len;
+} snap_frame;
+
+/* The chunks that the frames read, as vwm_seq_record's, in a ring of bytes.
+** head and tail only grow; the records that are kept are within them. */
+#ifndef VWM_SEQ_RING_SIZE
+#define VWM_SEQ_RING_SIZE (1 << 22)
+#endif
+
+typedef struct seq_ring {
+  char *bytes;
+
+  ulong
+    head,
+    tail;
+
+  unsigned int
+    num_records,
+    num_dropped;
+} seq_ring;
+
+/* The render buffers of the frames and of the windows. They are reset after
+** every flush and they are kept warm, and when a frame or a window goes, its
+** buffer waits here for the next one. */
+#define RENDER_ARENA_MAX    8
+#define RENDER_WARM_SIZE    (1 << 14)
+#define RENDER_KEEP_SIZE    (1 << 18)
+
+typedef struct render_arena {
+  string_t *free[RENDER_ARENA_MAX];
+  int num_free;
+} render_arena;
+
+typedef struct frame_recorder frame_recorder;
+
 struct vwm_frame {
   char
+    *cwd,
     **argv,
     mb_buf[8],
     tty_name[1024];
@@ -166,7 +279,8 @@ struct vwm_frame {
   uchar
     charset[2],
     textattr,
-    saved_textattr;
+    saved_textattr,
+    *wrapped;
 
   int
     fd,
@@ -192,6 +306,10 @@ struct vwm_frame {
     saved_row_pos,
     saved_col_pos,
     old_attribute,
+    grid_rows,
+    grid_cols,
+    num_hist,
+    *grid,
     **colors,
     **videomem,
     *tabstops,
@@ -200,6 +318,16 @@ struct vwm_frame {
 
   utf8 mb_code;
 
+  /* renewed when the grid changes, see win_render_key() */
+  uint64_t gen;
+
+  /* the frame in the records of the sequence trace */
+  unsigned int id;
+
+  frame_recorder *recorder;
+
+  vframe_counters counters;
+
   enum vt_keystate key_state;
 
   pid_t pid;
@@ -213,6 +341,9 @@ struct vwm_frame {
   FrameUnimplemented_cb unimplemented_cb;
   FrameAtFork_cb        at_fork_cb;
 
+  /* when set, the render goes here instead of the root output */
+  FrameOutput_cb        output_cb;
+
   vwm_t   *root;
   vwm_win *parent;
 
@@ -246,7 +377,15 @@ struct vwm_win {
     num_visible_frames,
     draw_separators,
     num_separators,
-    is_initialized;
+    is_restored,
+    is_initialized,
+    need_layout;
+
+  /* the first render_len bytes of render are the frames as of render_key */
+  size_t render_len;
+  uint64_t render_key;
+
+  vwin_counters counters;
 
   vwm_frame
     *head,
@@ -281,9 +420,9 @@ struct vwm_prop {
     *sequences_fname,
     *unimplemented_fname;
 
-  FILE
-    *unimplemented_fp,
-    *sequences_fp;
+  FILE *unimplemented_fp;
+
+  seq_ring *sequences;
 
   int
     state,
@@ -291,8 +430,15 @@ struct vwm_prop {
     num_rows,
     num_cols,
     need_resize,
+    need_reap,
     first_column;
 
+  int
+    resize_rows,
+    resize_cols;
+
+  long resize_at;
+
   uint modes;
 
   vwm_win
@@ -316,9 +462,45 @@ struct vwm_prop {
 
   int num_process_input_cbs;
   ProcessInput_cb *process_input_cbs;
+
+  /* when set, the rendered output goes here instead of stdout */
+  VwmOutput_cb output_cb;
+
+  /* a descriptor that is watched along with the input */
+  int extern_fd;
+  VwmExternFd_cb extern_fd_cb;
+
+  /* written by the SIGCHLD handler, so a child exit wakes up the loop */
+  int sigchld_fd[2];
+
+  int
+    pool_size,
+    pool_len,
+    pool_argc;
+
+  char **pool_argv;
+  pool_pty pool[VWM_POOL_MAX];
+
+  /* shared by the frames, to hold their lines while they are reflowed */
+  int *reflow_buf;
+  size_t reflow_len;
+
+  render_arena renders;
+
+  vwm_counters counters;
+
+  unsigned int frame_id;
+
+  /* the last generation given to a grid; they are never given twice */
+  uint64_t gen;
 };
 
 static void vwm_sigwinch_handler (int sig);
+static void vt_write_bytes (vwm_t *, char *, size_t);
+static void vwm_sigchld_handler (int sig);
+static void argv_release (char **argv, int *argc);
+static void vwm_fork_frames (vwm_t *, vwm_win *);
+static void vwm_layout_win (vwm_t *, vwm_win *);
 
 static const utf8 offsetsFromUTF8[6] = {
   0x00000000UL, 0x00003080UL, 0x000E2080UL,
@@ -448,6 +630,41 @@ static void fd_set_size (int fd, int rows, int cols) {
   ioctl (fd, TIOCSWINSZ, &wsiz);
 }
 
+/* Closes every descriptor from lowfd up, without one syscall for every
+** possible descriptor, as _SC_OPEN_MAX might well be in the millions. */
+static void fd_close_from (int lowfd) {
+#ifdef SYS_close_range
+  if (0 is syscall (SYS_close_range, lowfd, ~0U, 0))
+    return;
+#endif
+
+  DIR *dir = opendir ("/proc/self/fd");
+
+  if (NULL is dir) {
+    int maxfd;
+#ifdef OPEN_MAX
+    maxfd = OPEN_MAX;
+#else
+    maxfd = sysconf (_SC_OPEN_MAX);
+#endif
+
+    for (int fd = lowfd; fd < maxfd; fd++)
+      if (close (fd) is -1 and errno is EBADF)
+        break;
+
+    return;
+  }
+
+  struct dirent *dp;
+  while (NULL isnot (dp = readdir (dir))) {
+    int fd = atoi (dp->d_name);
+    if (fd >= lowfd and fd isnot dirfd (dir))
+      close (fd);
+  }
+
+  closedir (dir);
+}
+
 static size_t byte_cp (char *dest, const char *src, size_t nelem) {
   const char *sp = src;
   size_t len = 0;
@@ -498,9 +715,15 @@ static size_t string_align (size_t size) {
   return sz;
 }
 
-/* this is not like realloc(), as size here is the extra size */
+/* this is not like realloc(), as size here is the extra size; the buffer
+ * at least doubles, so a string that is built a few bytes at a time, as
+ * the renders are, reallocates only a few times until it is warm */
 static string_t *string_reallocate (string_t *this, size_t size) {
-  size_t sz = string_align (this->mem_size + size + 1);
+  size_t sz = this->mem_size * 2;
+  if (sz < this->mem_size + size + 1)
+    sz = this->mem_size + size + 1;
+
+  sz = string_align (sz);
   this->bytes = Realloc (this->bytes, sz);
   this->mem_size = sz;
   return this;
@@ -559,14 +782,25 @@ static string_t *string_clear_at (string_t *this, int idx) {
   return this;
 }
 
-static string_t *string_append_with_len (string_t *this, char *bytes, size_t len) {
+/* releases the memory over size, that a burst left behind; the buffer
+ * keeps at least size bytes, so the next fill starts warm */
+static string_t *string_trim (string_t *this, size_t size) {
+  size = string_align (size);
+  if (this->mem_size <= size or this->num_bytes >= size) return this;
+
+  this->bytes = Realloc (this->bytes, size);
+  this->mem_size = size;
+  return this;
+}
+
+static inline string_t *string_append_with_len (string_t *this, char *bytes, size_t len) {
   size_t bts = this->num_bytes + len;
-  if (bts >= this->mem_size)
-    this = string_reallocate (this, bts - this->mem_size + 1);
+  if (unlikely (bts >= this->mem_size))
+    string_reallocate (this, bts - this->mem_size + 1);
 
-  byte_cp (this->bytes + this->num_bytes, bytes, len);
-  this->num_bytes += len;
-  this->bytes[this->num_bytes] = '\0';
+  memcpy (this->bytes + this->num_bytes, bytes, len);
+  this->num_bytes = bts;
+  this->bytes[bts] = '\0';
   return this;
 }
 
@@ -574,14 +808,47 @@ static string_t *string_append (string_t *this, char *bytes) {
   return string_append_with_len (this, bytes, bytelen (bytes));
 }
 
-static string_t *string_append_byte (string_t *this, char c) {
-  int bts = this->mem_size - (this->num_bytes + 2);
-  if (1 > bts) string_reallocate (this, 8);
-  this->bytes[this->num_bytes++] = c;
-  this->bytes[this->num_bytes] = '\0';
+static inline string_t *string_append_byte (string_t *this, char c) {
+  if (unlikely (this->num_bytes + 2 > this->mem_size))
+    string_reallocate (this, 8);
+
+  char *sp = this->bytes + this->num_bytes++;
+  sp[0] = c;
+  sp[1] = '\0';
   return this;
 }
 
+static string_t *render_arena_get (render_arena *arena) {
+  if (arena->num_free)
+    return arena->free[--arena->num_free];
+
+  return string_new (RENDER_WARM_SIZE);
+}
+
+/* this is after a flush; a buffer that a burst grew over the keep size,
+ * shrinks back to the warm size */
+static void render_arena_reset (string_t *render) {
+  string_clear (render);
+
+  if (render->mem_size > RENDER_KEEP_SIZE)
+    string_trim (render, RENDER_WARM_SIZE);
+}
+
+static void render_arena_put (render_arena *arena, string_t *render) {
+  if (arena->num_free is RENDER_ARENA_MAX) {
+    string_release (render);
+    return;
+  }
+
+  render_arena_reset (render);
+  arena->free[arena->num_free++] = render;
+}
+
+static void render_arena_release (render_arena *arena) {
+  while (arena->num_free)
+    string_release (arena->free[--arena->num_free]);
+}
+
 static void dirlist_free (dirlist_t *dlist) {
   if (NULL is dlist->list)
     return;
@@ -749,6 +1016,7 @@ static vwm_term *vwm_new_term (vwm_t *this) {
   term->in_fd = STDIN_FILENO;
   term->out_fd = STDOUT_FILENO;
   term->mode = 'o';
+  term->root = this;
 
   char *term_name = getenv ("TERM");
   if (NULL is term_name) {
@@ -837,8 +1105,20 @@ static int term_raw_mode (vwm_term *this) {
   return OK;
 }
 
+/* The escapes go the way of the render, to the output_cb when it is set,
+** as the master of the integrated mode has no terminal and its clients
+** have to see them. A query is the exception, as the answer comes from
+** this terminal. */
+static int term_write (vwm_term *this, char *bytes, size_t len) {
+  if (NULL is this->root)
+    return fd_write (this->out_fd, bytes, len);
+
+  vt_write_bytes (this->root, bytes, len);
+  return OK;
+}
+
 static int term_cursor_get_ptr_pos (vwm_term *this, int *row, int *col) {
-  if (NOTOK == TERM_SEND_ESC_SEQ (TERM_GET_PTR_POS))
+  if (NOTOK == fd_write (this->out_fd, TERM_GET_PTR_POS, TERM_GET_PTR_POS_LEN))
     return NOTOK;
 
   char buf[32];
@@ -865,7 +1145,7 @@ static int term_cursor_get_ptr_pos (vwm_term *this, int *row, int *col) {
 static void term_cursor_set_ptr_pos (vwm_term *this, int row, int col) {
   char ptr[32];
   snprintf (ptr, 32, TERM_GOTO_PTR_POS_FMT, row, col);
-  fd_write (this->out_fd, ptr, bytelen (ptr));
+  term_write (this, ptr, bytelen (ptr));
 }
 
 static void term_screen_clear (vwm_term *this) {
@@ -896,7 +1176,7 @@ static void term_init_size (vwm_term *this, int *rows, int *cols) {
   int orig_row, orig_col;
   term_cursor_get_ptr_pos (this, &orig_row, &orig_col);
 
-  TERM_SEND_ESC_SEQ (TERM_LAST_RIGHT_CORNER);
+  fd_write (this->out_fd, TERM_LAST_RIGHT_CORNER, TERM_LAST_RIGHT_CORNER_LEN);
   term_cursor_get_ptr_pos (this, rows, cols);
   term_cursor_set_ptr_pos (this, orig_row, orig_col);
 }
@@ -933,8 +1213,20 @@ static void vwm_set_size (vwm_t *this, int rows, int cols, int first_col) {
   $my(first_column) = first_col;
 }
 
+static void vwm_set_output_cb (vwm_t *this, VwmOutput_cb cb) {
+  $my(output_cb) = cb;
+}
+
+static void vwm_set_extern_fd (vwm_t *this, int fd, VwmExternFd_cb cb) {
+  $my(extern_fd) = fd;
+  $my(extern_fd_cb) = cb;
+}
+
 static void vwm_set_term  (vwm_t *this, vwm_term *term) {
   $my(term) = term;
+
+  ifnot (NULL is term)
+    term->root = this;
 }
 
 static void vwm_set_state (vwm_t *this, int state) {
@@ -949,12 +1241,42 @@ static void vwm_set_editor (vwm_t *this, char *editor) {
   string_append_with_len ($my(editor), editor, len);
 }
 
+static void vwm_pool_release (vwm_t *this, int keep) {
+  while ($my(pool_len) > keep) {
+    pool_pty *p = &$my(pool)[--$my(pool_len)];
+    kill (p->pid, SIGHUP);
+    waitpid (p->pid, NULL, 0);
+    close (p->fd);
+  }
+
+  if (0 is keep and NULL isnot $my(pool_argv))
+    argv_release ($my(pool_argv), &$my(pool_argc));
+
+  ifnot (keep)
+    $my(pool_argv) = NULL;
+}
+
+/* Keeps num ptys with default_app started ahead of time, so that new
+** frames come up with a ready prompt; 0 turns it off. */
+static void vwm_set_pool (vwm_t *this, int num) {
+  if (num < 0) num = 0;
+  if (num > VWM_POOL_MAX) num = VWM_POOL_MAX;
+
+  $my(pool_size) = num;
+
+  if ($my(pool_len) > num)
+    vwm_pool_release (this, num);
+}
+
 static void vwm_set_default_app (vwm_t *this, char *app) {
   if (NULL is app) return;
   size_t len = bytelen (app);
   ifnot (len) return;
   string_clear ($my(default_app));
   string_append_with_len ($my(default_app), app, len);
+
+  /* what is in the pool runs the previous one */
+  vwm_pool_release (this, 0);
 }
 
 static void vwm_set_on_tab_cb (vwm_t *this, VwmOnTab_cb cb) {
@@ -982,12 +1304,22 @@ static void vwm_set_shell (vwm_t *this, char *shell) {
   string_append_with_len ($my(shell), shell, len);
 }
 
+/* The files that should outlive the process, go next to its temporary
+** directory, that is in the parent. */
+static void vwm_outside_tmpdir (vwm_t *this, char *buf, size_t size, char *name) {
+  char *tmpdir = self(get.tmpdir);
+  char *sp = strrchr (tmpdir, '/');
+  int tmpdir_len = (NULL is sp or sp is tmpdir ? (int) bytelen (tmpdir) : (int) (sp - tmpdir));
+  snprintf (buf, size, "%.*s/%s", tmpdir_len, tmpdir, name);
+}
+
 static void vwm_set_debug_unimplemented (vwm_t *this, char *fname) {
   self(unset.debug.unimplemented);
 
   if (NULL is fname) {
-    tmpname_t t = tmpfname (self(get.tmpdir),
-        V_STR_FMT_LEN (64, "%d_unimplemented", getpid ()));
+    char name[64];
+    snprintf (name, 64, "%d_unimplemented", getpid ());
+    tmpname_t t = tmpfname (self(get.tmpdir), name);
 
     if (-1 is t.fd) return;
 
@@ -1008,30 +1340,74 @@ static void vwm_unset_debug_unimplemented (vwm_t *this) {
   string_free ($my(unimplemented_fname));
 }
 
+/* Starts to keep what the frames read, in memory; fname is where it is
+** saved by Vwm.save_sequences, by default next to the temporary directory. */
 static void vwm_set_debug_sequences (vwm_t *this, char *fname) {
   self(unset.debug.sequences);
 
   if (NULL is fname) {
-    tmpname_t t = tmpfname (self(get.tmpdir),
-        V_STR_FMT_LEN (64, "%d_sequences", getpid ()));
+    char fbuf[PATH_MAX], name[64];
+    snprintf (name, 64, "vwm_sequences_%d.seq", getpid ());
+    vwm_outside_tmpdir (this, fbuf, PATH_MAX, name);
+    $my(sequences_fname) = string_new_with (fbuf);
+  } else
+    $my(sequences_fname) = string_new_with (fname);
 
-    if (-1 is t.fd) return;
+  $my(sequences) = Alloc (sizeof (seq_ring));
+  $my(sequences)->bytes = Alloc (VWM_SEQ_RING_SIZE);
+}
+
+static void vwm_unset_debug_sequences (vwm_t *this) {
+  if (NULL is $my(sequences)) return;
+  free ($my(sequences)->bytes);
+  free ($my(sequences));
+  $my(sequences) = NULL;
+  string_free ($my(sequences_fname));
+  $my(sequences_fname) = NULL;
+}
 
-    $my(sequences_fp) = fdopen (t.fd, "w+");
-    $my(sequences_fname) = t.fname;
+static int vwm_save_sequences (vwm_t *this, char *fname) {
+  seq_ring *ring = $my(sequences);
+  if (NULL is ring) return NOTOK;
 
-    return;
+  if (NULL is fname)
+    fname = $my(sequences_fname)->bytes;
+
+  int fd = open (fname, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR);
+  if (-1 is fd) return NOTOK;
+
+  vwm_seq_header hdr = {
+    .version = VWM_SEQ_VERSION,
+    .byte_order = VWM_SEQ_BYTEORDER,
+    .num_records = ring->num_records,
+    .num_dropped = ring->num_dropped
+  };
+
+  memcpy (hdr.magic, VWM_SEQ_MAGIC, sizeof (VWM_SEQ_MAGIC));
+
+  int retval = NOTOK;
+
+  if (NOTOK is fd_write (fd, (char *) &hdr, sizeof (vwm_seq_header)))
+    goto theend;
+
+  /* at most two pieces, when the records wrap around the end of the ring */
+  ulong pos = ring->tail;
+  while (pos < ring->head) {
+    size_t off = pos & (VWM_SEQ_RING_SIZE - 1);
+    size_t len = VWM_SEQ_RING_SIZE - off;
+    if (len > ring->head - pos) len = ring->head - pos;
+
+    if (NOTOK is fd_write (fd, ring->bytes + off, len))
+      goto theend;
+
+    pos += len;
   }
 
-  $my(sequences_fname) = string_new_with (fname);
-  $my(sequences_fp) = fopen (fname, "w");
-}
+  retval = OK;
 
-static void vwm_unset_debug_sequences (vwm_t *this) {
-  if (NULL is $my(sequences_fp)) return;
-  fclose ($my(sequences_fp));
-  $my(sequences_fp) = NULL;
-  string_free ($my(sequences_fname));
+theend:
+  if (-1 is close (fd)) retval = NOTOK;
+  return retval;
 }
 
 static void vwm_unset_tmpdir (vwm_t *this) {
@@ -1050,8 +1426,10 @@ static int vwm_set_tmpdir (vwm_t *this, char *dir, size_t len) {
   else
     string_append_with_len ($my(tmpdir), dir, len);
 
+  char name[64];
+  snprintf (name, 64, "%d-vwm_tmpdir", getpid ());
   string_append_byte ($my(tmpdir), '/');
-  string_append ($my(tmpdir), V_STR_FMT_LEN (64, "%d-vwm_tmpdir", getpid ()));
+  string_append ($my(tmpdir), name);
 
   if (-1 is access ($my(tmpdir)->bytes, F_OK)) {
     if (-1 is mkdir ($my(tmpdir)->bytes, S_IRWXU))
@@ -1079,13 +1457,45 @@ theerror:
  * of such sequence
  */
 
+/* A key sequence may arrive in pieces, and while waiting for the rest,
+** the extern descriptor is still served, as it might be what feeds
+** the input. */
+static int vwm_read_key (vwm_t *this, int infd, char *buf) {
+  while ($my(extern_fd) isnot -1) {
+    fd_set read_mask;
+    FD_ZERO (&read_mask);
+    FD_SET (infd, &read_mask);
+    FD_SET ($my(extern_fd), &read_mask);
+
+    int maxfd = (infd > $my(extern_fd) ? infd : $my(extern_fd)) + 1;
+
+    /* infd might be a pipe, so wait only as long as VTIME in raw mode,
+    ** or the rest of a sequence would wait for the next key */
+    struct timeval tv = {.tv_sec = 0, .tv_usec = 100000};
+
+    int n = select (maxfd, &read_mask, NULL, NULL, &tv);
+    if (0 is n)
+      return 0;
+
+    if (0 > n)
+      continue;
+
+    if (FD_ISSET ($my(extern_fd), &read_mask))
+      $my(extern_fd_cb) (this, $my(extern_fd));
+
+    if (FD_ISSET (infd, &read_mask))
+      break;
+  }
+
+  return fd_read (infd, buf, 1);
+}
+
 static utf8 vwm_getkey (vwm_t *this, int infd) {
-  (void) this;
   char c;
   int n;
   char buf[5];
 
-  while (0 == (n = fd_read (infd, buf, 1)));
+  while (0 == (n = vwm_read_key (this, infd, buf)));
 
   if (n == -1) return -1;
 
@@ -1093,7 +1503,7 @@ static utf8 vwm_getkey (vwm_t *this, int infd) {
 
   switch (c) {
     case ESCAPE_KEY:
-      if (0 == fd_read (infd, buf, 1))
+      if (0 == vwm_read_key (this, infd, buf))
         return ESCAPE_KEY;
 
       /* recent (revailed through CTRL-[other than CTRL sequence]) and unused */
@@ -1101,18 +1511,18 @@ static utf8 vwm_getkey (vwm_t *this, int infd) {
         return 0;
 
       if (buf[0] == ESCAPE_KEY /* probably alt->arrow-key */)
-        if (0 == fd_read (infd, buf, 1))
+        if (0 == vwm_read_key (this, infd, buf))
           return 0;
 
       if (buf[0] != '[' && buf[0] != 'O')
         return 0;
 
-      if (0 == fd_read (infd, buf + 1, 1))
+      if (0 == vwm_read_key (this, infd, buf + 1))
         return ESCAPE_KEY;
 
       if (buf[0] == '[') {
         if ('0' <= buf[1] && buf[1] <= '9') {
-          if (0 == fd_read (infd, buf + 2, 1))
+          if (0 == vwm_read_key (this, infd, buf + 2))
             return ESCAPE_KEY;
 
           if (buf[2] == '~') {
@@ -1128,7 +1538,7 @@ static utf8 vwm_getkey (vwm_t *this, int infd) {
               default: return 0;
             }
           } else if (buf[1] == '1') {
-            if (fd_read (infd, buf, 1) == 0)
+            if (vwm_read_key (this, infd, buf) == 0)
               return ESCAPE_KEY;
 
             switch (buf[2]) {
@@ -1143,7 +1553,7 @@ static utf8 vwm_getkey (vwm_t *this, int infd) {
               default: return 0;
             }
           } else if (buf[1] == '2') {
-            if (fd_read (infd, buf, 1) == 0)
+            if (vwm_read_key (this, infd, buf) == 0)
               return ESCAPE_KEY;
 
             switch (buf[2]) {
@@ -1161,7 +1571,7 @@ static utf8 vwm_getkey (vwm_t *this, int infd) {
               return 0;
           }
         } else if (buf[1] == '[') {
-          if (fd_read (infd, buf, 1) == 0)
+          if (vwm_read_key (this, infd, buf) == 0)
             return ESCAPE_KEY;
 
           switch (buf[0]) {
@@ -1215,7 +1625,7 @@ static utf8 vwm_getkey (vwm_t *this, int infd) {
       char cc;
 
       for (idx = 0; idx < len - 1; idx++) {
-        if (0 >= fd_read (infd, &cc, 1))
+        if (0 >= vwm_read_key (this, infd, &cc))
           return -1;
 
         if (isnotutf8 ((uchar) cc)) {
@@ -1247,6 +1657,11 @@ static vwm_win *vwm_set_current_at (vwm_t *this, int idx) {
     if (NULL isnot cur_win)
       $my(last_win) = cur_win;
   }
+
+  /* a resize that happened while it was in the background */
+  if (NULL isnot $my(current) and $my(current)->need_layout)
+    vwm_layout_win (this, $my(current));
+
   return $my(current);
 }
 
@@ -1336,7 +1751,7 @@ static void win_release_info (vwin_info *winfo) {
   if (NULL is winfo) return;
 
   for (int fidx = 0; fidx < winfo->num_frames; fidx++)
-    frame_release_info (winfo->frames[fidx++]);
+    frame_release_info (winfo->frames[fidx]);
 
   free (winfo->frames);
   free (winfo);
@@ -1350,7 +1765,7 @@ static void vwm_release_info (vwm_t *this, vwm_info **vinfop) {
   vwm_info *vinfo = *vinfop;
 
   for (int widx = 0; widx < vinfo->num_win; widx++)
-    win_release_info (vinfo->wins[widx++]);
+    win_release_info (vinfo->wins[widx]);
 
   free (vinfo->wins);
   free (vinfo);
@@ -1364,9 +1779,10 @@ static vframe_info *frame_get_info (vwm_frame *this) {
   finfo->num_rows = this->num_rows;
   finfo->last_row = this->first_row + this->num_rows - 1;
   finfo->is_visible = this->is_visible;
-  finfo->is_current = this->parent->current is this;
+  finfo->is_current = (NULL isnot this->parent and this->parent->current is this);
   finfo->at_frame = (this->is_visible ? this->at_frame : -1);
   finfo->logfile = (NULL is this->logfile ? "" : this->logfile->bytes);
+  finfo->counters = this->counters;
 
   int arg = 0;
   for (; arg < this->argc; arg++)
@@ -1387,6 +1803,7 @@ static vwin_info *win_get_info (vwm_win *this) {
   winfo->num_frames = this->length;
   winfo->cur_frame_idx = this->cur_idx;
   winfo->is_current = Vwm.get.current_win (vwm) is this;
+  winfo->counters = this->counters;
 
   winfo->frames = Alloc (sizeof (vframe_info) * this->length);
   vwm_frame *frame = this->head;
@@ -1405,6 +1822,7 @@ static vwm_info *vwm_get_info (vwm_t *this) {
   vinfo->pid = getpid ();
   vinfo->num_win = $my(length);
   vinfo->cur_win_idx = $my(cur_idx);
+  vinfo->counters = $my(counters);
   vinfo->sequences_fname = (NULL is $my(sequences_fname) ? "" :
       $my(sequences_fname)->bytes);
   vinfo->unimplemented_fname = (NULL is $my(unimplemented_fname) ? "" :
@@ -1425,17 +1843,62 @@ static vwm_win *vwm_pop_win_at (vwm_t *this, int idx) {
   return DListPopAt ($myprop, vwm_win, idx);
 }
 
-static int **vwm_alloc_ints (int rows, int cols, int val) {
-  int **obj = Alloc (rows * sizeof (int *));
+static void frame_new_gen (vwm_frame *this) {
+  this->gen = ++this->root->prop->gen;
+}
+
+/* The grid of a frame is a single slab, of grid_rows rows of grid_cols
+** cells, followed by as many rows of colors. The videomem and colors rows
+** point into it. The first num_rows are on the screen, the next num_hist
+** hold the lines that went off the top, the most recent first, and the
+** rest are spare. A resize that fits in the slab reuses it. */
+static void frame_grid_new (vwm_frame *this, int rows, int cols) {
+  size_t cells = (size_t) rows * cols;
+
+  this->grid = Alloc (sizeof (int) * cells * 2);
+  this->wrapped = Alloc ((size_t) rows);
+  this->videomem = Alloc (sizeof (int *) * rows);
+  this->colors = Alloc (sizeof (int *) * rows);
+  this->grid_rows = rows;
+  this->grid_cols = cols;
+  this->num_hist = 0;
 
   for (int i = 0; i < rows; i++) {
-    obj[i] = Alloc (sizeof (int *) * cols);
+    this->videomem[i] = this->grid + (size_t) i * cols;
+    this->colors[i] = this->grid + cells + (size_t) i * cols;
 
     for (int j = 0; j < cols; j++)
-      obj[i][j] = val;
- }
+      this->colors[i][j] = COLOR_FG_NORMAL;
+  }
+}
 
- return obj;
+static void frame_grid_release (vwm_frame *this) {
+  free (this->grid);
+  free (this->wrapped);
+  free (this->videomem);
+  free (this->colors);
+  this->grid = NULL;
+  this->videomem = this->colors = NULL;
+  this->wrapped = NULL;
+}
+
+/* The flag of a row, that is set when its line continues on the next. */
+#define ROW_WRAPPED(__f__, __row__) \
+  (__f__)->wrapped[((__row__) - (__f__)->grid) / (__f__)->grid_cols]
+
+/* A frame that was created lazily, has no grid until it is forked or
+** drawn for the first time. */
+static void frame_alloc_grid (vwm_frame *frame) {
+  ifnot (NULL is frame->videomem) return;
+
+  frame_grid_new (frame, frame->num_rows, frame->num_cols);
+  frame->tabstops = Alloc (sizeof (int) * frame->num_cols);
+  for (int i = 0; i < frame->num_cols; i++) {
+    ifnot ((int) i % TABWIDTH)
+      frame->tabstops[i] = 1;
+    else
+      frame->tabstops[i] = 0;
+  }
 }
 
 static int vt_video_line_to_str (int *line, char *buf, int len) {
@@ -1473,17 +1936,102 @@ static int vt_video_line_to_str (int *line, char *buf, int len) {
   return idx;
 }
 
-static void vt_write (char *buf, FILE *fp) {
-  fprintf (fp, "%s", buf);
-  fflush (fp);
+static void vt_write_bytes (vwm_t *root, char *bytes, size_t len) {
+  if (root->prop->output_cb) {
+    root->prop->output_cb (root, bytes, len);
+    return;
+  }
+
+  fwrite (bytes, 1, len, stdout);
+  fflush (stdout);
+}
+
+static void vt_write (vwm_t *root, string_t *buf) {
+  vt_write_bytes (root, buf->bytes, buf->num_bytes);
+}
+
+/* The sequences are written straight into the render, and their numbers
+** two digits at a time from a table, as they are in every draw. */
+static const char digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static inline char *seq_put_int (char *sp, int num) {
+  char tmp[12];
+  char *tp = tmp + sizeof (tmp);
+
+  uint n = (uint) num;
+  if (num < 0) {
+    *sp++ = '-';
+    n = -n;
+  }
+
+  while (n >= 100) {
+    const char *dp = digit_pairs + (n % 100) * 2;
+    n /= 100;
+    *--tp = dp[1];
+    *--tp = dp[0];
+  }
+
+  if (n >= 10) {
+    *--tp = digit_pairs[n * 2 + 1];
+    *--tp = digit_pairs[n * 2];
+  } else
+    *--tp = '0' + n;
+
+  size_t len = tmp + sizeof (tmp) - tp;
+  memcpy (sp, tp, len);
+  return sp + len;
+}
+
+/* room for a sequence is made once, so it is written with no checks */
+static inline char *seq_begin (string_t *buf) {
+  if (unlikely (buf->num_bytes + MAX_SEQ_LEN >= buf->mem_size))
+    string_reallocate (buf, buf->num_bytes + MAX_SEQ_LEN - buf->mem_size + 1);
+
+  char *sp = buf->bytes + buf->num_bytes;
+  *sp++ = '\033';
+  *sp++ = '[';
+  return sp;
+}
+
+static inline string_t *seq_end (string_t *buf, char *sp, char final) {
+  *sp++ = final;
+  *sp = '\0';
+  buf->num_bytes = sp - buf->bytes;
+  return buf;
+}
+
+/* ESC [ num final */
+static string_t *vt_csi (string_t *buf, int num, char final) {
+  char *sp = seq_begin (buf);
+  sp = seq_put_int (sp, num);
+  return seq_end (buf, sp, final);
+}
+
+/* ESC [ first ; second final */
+static string_t *vt_csi2 (string_t *buf, int first, int second, char final) {
+  char *sp = seq_begin (buf);
+  sp = seq_put_int (sp, first);
+  *sp++ = ';';
+  sp = seq_put_int (sp, second);
+  return seq_end (buf, sp, final);
 }
 
 static string_t *vt_insline (string_t *buf, int num) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%dL", num));
+  return vt_csi (buf, num, 'L');
 }
 
 static string_t *vt_insertchar (string_t *buf, int numcols) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%d@", numcols));
+  return vt_csi (buf, numcols, '@');
 }
 
 static string_t *vt_savecursor (string_t *buf) {
@@ -1507,11 +2055,11 @@ static string_t *vt_clrline (string_t *buf) {
 }
 
 static string_t *vt_delunder (string_t *buf, int num) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%dP", num));
+  return vt_csi (buf, num, 'P');
 }
 
 static string_t *vt_delline (string_t *buf, int num) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%dM", num));
+  return vt_csi (buf, num, 'M');
 }
 
 static string_t *vt_attr_reset (string_t *buf) {
@@ -1519,23 +2067,23 @@ static string_t *vt_attr_reset (string_t *buf) {
 }
 
 static string_t *vt_reverse (string_t *buf, int on) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%sm", (on ? "7" : "27")));
+  return vt_csi (buf, (on ? 7 : 27), 'm');
 }
 
 static string_t *vt_underline (string_t *buf, int on) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%sm", (on ? "4" : "24")));
+  return vt_csi (buf, (on ? 4 : 24), 'm');
 }
 
 static string_t *vt_bold (string_t *buf, int on) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%sm", (on ? "1" : "22")));
+  return vt_csi (buf, (on ? 1 : 22), 'm');
 }
 
 static string_t *vt_italic (string_t *buf, int on) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%sm", (on ? "3" : "23")));
+  return vt_csi (buf, (on ? 3 : 23), 'm');
 }
 
 static string_t *vt_blink (string_t *buf, int on) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%sm", (on ? "5" : "25")));
+  return vt_csi (buf, (on ? 5 : 25), 'm');
 }
 
 static string_t *vt_bell (string_t *buf) {
@@ -1543,27 +2091,27 @@ static string_t *vt_bell (string_t *buf) {
 }
 
 static string_t *vt_setfg (string_t *buf, int color) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%d;1m", color));
+  return vt_csi2 (buf, color, 1, 'm');
 }
 
 static string_t *vt_setbg (string_t *buf, int color) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%d;1m", color));
+  return vt_csi2 (buf, color, 1, 'm');
 }
 
 static string_t *vt_left (string_t *buf, int count) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%dD", count));
+  return vt_csi (buf, count, 'D');
 }
 
 static string_t *vt_right (string_t *buf, int count) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%dC", count));
+  return vt_csi (buf, count, 'C');
 }
 
 static string_t *vt_up (string_t *buf, int numrows) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%dA", numrows));
+  return vt_csi (buf, numrows, 'A');
 }
 
 static string_t *vt_down (string_t *buf, int numrows) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%dB", numrows));
+  return vt_csi (buf, numrows, 'B');
 }
 
 static string_t *vt_irm (string_t *buf) {
@@ -1578,11 +2126,11 @@ static string_t *vt_setscroll (string_t *buf, int first, int last) {
   if (0 is first and 0 is last)
     return string_append_with_len (buf, "\033[r", 3);
   else
-    return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%d;%dr", first, last));
+    return vt_csi2 (buf, first, last, 'r');
 }
 
 static string_t *vt_goto (string_t *buf, int row, int col) {
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%d;%dH", row, col));
+  return vt_csi2 (buf, row, col, 'H');
 }
 
 static string_t *vt_attr_check (string_t *buf, int pixel, int lastattr, uchar *currattr) {
@@ -1706,11 +2254,15 @@ static void vt_video_add (vwm_frame *frame, utf8 c) {
 static void vt_video_erase (vwm_frame *frame, int x1, int x2, int y1, int y2) {
   int i, j;
 
-  for (i = x1 - 1; i < x2; ++i)
+  for (i = x1 - 1; i < x2; ++i) {
     for (j = y1 - 1; j < y2; ++j) {
       frame->videomem[i][j] = 0;
       frame->colors  [i][j] = COLOR_FG_NORM;
     }
+
+    if (y2 >= frame->num_cols)
+      ROW_WRAPPED (frame, frame->videomem[i]) = 0;
+  }
 }
 
 static void vt_frame_video_rshift (vwm_frame *frame, int numcols) {
@@ -1731,7 +2283,7 @@ static string_t *vt_frame_ech (vwm_frame *frame, string_t *buf, int num_cols) {
     frame->colors[frame->row_pos-1][frame->col_pos - i - 1] = COLOR_FG_NORM;
   }
 
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%dX", num_cols));
+  return vt_csi (buf, num_cols, 'X');
 }
 
 /*
@@ -1744,7 +2296,7 @@ static string_t *vt_frame_cha (vwm_frame *frame, string_t *buf, int param) {
     frame->col_pos = param;
   }
 
-  return string_append (buf, V_STR_FMT_LEN (MAX_SEQ_LEN, "\033[%dG", param));
+  return vt_csi (buf, param, 'G');
 }
 */
 
@@ -1753,6 +2305,8 @@ static void vt_frame_video_scroll (vwm_frame *frame, int numlines) {
   int *tmpcolors;
   int n;
 
+  frame->counters.scrolled_lines += numlines;
+
   for (int i = 0; i < numlines; i++) {
     tmpvideo = frame->videomem[frame->scroll_first_row - 1];
     tmpcolors = frame->colors[frame->scroll_first_row - 1];
@@ -1760,7 +2314,30 @@ static void vt_frame_video_scroll (vwm_frame *frame, int numlines) {
     ifnot (NULL is frame->logfile) {
       char buf[(frame->num_cols * 3) + 2];
       int len = vt_video_line_to_str (tmpvideo, buf, frame->num_cols);
+      VWM_TRACE_BEGIN ("log");
       fd_write (frame->logfd, buf, len);
+      VWM_TRACE_END ("log");
+    }
+
+    /* While the slab has rows to spare, the line that leaves the top is
+    ** kept in the history, and the oldest one is reused once it's full. */
+    if (frame->scroll_first_row is 1 and frame->grid_rows > frame->num_rows) {
+      int max = frame->grid_rows - frame->num_rows;
+      int keep = (frame->num_hist < max ? frame->num_hist : max - 1);
+      int *hist_video = frame->videomem[frame->num_rows + keep];
+      int *hist_colors = frame->colors[frame->num_rows + keep];
+
+      memmove (frame->videomem + frame->num_rows + 1, frame->videomem + frame->num_rows,
+          sizeof (int *) * keep);
+      memmove (frame->colors + frame->num_rows + 1, frame->colors + frame->num_rows,
+          sizeof (int *) * keep);
+
+      frame->videomem[frame->num_rows] = tmpvideo;
+      frame->colors[frame->num_rows] = tmpcolors;
+      frame->num_hist = keep + 1;
+
+      tmpvideo = hist_video;
+      tmpcolors = hist_colors;
     }
 
     for (int j = 0; j < frame->num_cols; j++) {
@@ -1768,6 +2345,8 @@ static void vt_frame_video_scroll (vwm_frame *frame, int numlines) {
       tmpcolors[j] = COLOR_FG_NORM;
     }
 
+    ROW_WRAPPED (frame, tmpvideo) = 0;
+
     for (n = frame->scroll_first_row - 1; n < frame->last_row - 1; n++) {
       frame->videomem[n] = frame->videomem[n + 1];
       frame->colors[n] = frame->colors[n + 1];
@@ -1782,6 +2361,8 @@ static void vt_frame_video_scroll_back (vwm_frame *frame, int numlines) {
   if (frame->row_pos < frame->scroll_first_row)
     return;
 
+  frame->counters.scrolled_lines += numlines;
+
   int n;
   int *tmpvideo;
   int *tmpcolors;
@@ -1795,6 +2376,8 @@ static void vt_frame_video_scroll_back (vwm_frame *frame, int numlines) {
       tmpcolors[j] = COLOR_FG_NORM;
     }
 
+    ROW_WRAPPED (frame, tmpvideo) = 0;
+
    for (n = frame->last_row - 1; n > frame->scroll_first_row - 1; --n) {
       frame->videomem[n] = frame->videomem[n - 1];
       frame->colors[n] = frame->colors[n - 1];
@@ -1813,6 +2396,8 @@ static string_t *vt_frame_attr_set (vwm_frame *frame, string_t *buf) {
 
 static string_t *vt_append (vwm_frame *frame, string_t *buf, utf8 c) {
   if (frame->col_pos > frame->num_cols) {
+    ROW_WRAPPED (frame, frame->videomem[frame->row_pos - 1]) = 1;
+
     if (frame->row_pos < frame->last_row)
       frame->row_pos++;
     else
@@ -1841,22 +2426,16 @@ static string_t *vt_keystate_print (string_t *buf, int application) {
 }
 
 static string_t *vt_altcharset (string_t *buf, int charset, int type) {
-  switch (type) {
-    case UK_CHARSET:
-      string_append_with_len (buf, V_STR_FMT_LEN (4, "\033%cA", (charset is G0 ? '(' : ')')), 3);
-      break;
-
-    case US_CHARSET:
-      string_append_with_len (buf, V_STR_FMT_LEN (4, "\033%cB", (charset is G0 ? '(' : ')')), 3);
-      break;
-
-    case GRAPHICS:
-      string_append_with_len (buf, V_STR_FMT_LEN (4, "\033%c0", (charset is G0 ? '(' : ')')), 3);
-      break;
+  char seq[3] = {'\033', (charset is G0 ? '(' : ')'), '\0'};
 
-    default:  break;
+  switch (type) {
+    case UK_CHARSET: seq[2] = 'A'; break;
+    case US_CHARSET: seq[2] = 'B'; break;
+    case GRAPHICS:   seq[2] = '0'; break;
+    default: return buf;
   }
-  return buf;
+
+  return string_append_with_len (buf, seq, 3);
 }
 
 static string_t *vt_esc_scan (vwm_frame *, string_t *, int);
@@ -2371,6 +2950,7 @@ frame->unimplemented_cb (frame, "brace why", c, frame->esc_param[0]);
       break;
 
     case 'm': /* Set terminal attributes */
+      frame->counters.num_sgr++;
       vt_process_m (frame, buf, frame->esc_param[0]);
       for (i = 1; frame->esc_param[i] and i < MAX_PARAMS; i++)
         vt_process_m (frame, buf, frame->esc_param[i]);
@@ -2531,6 +3111,11 @@ frame->unimplemented_cb (frame, "brace why", c, frame->esc_param[0]);
 }
 
 static string_t *vt_esc_e (vwm_frame *frame, string_t *buf, int c) {
+  if (c is '[')
+    frame->counters.num_csi++;
+  else
+    frame->counters.num_esc++;
+
   /* Return inside the switch to prevent reset_esc() */
   switch (c) {
     case '\030': /* Processed as escape cancel */
@@ -2641,6 +3226,9 @@ static string_t *vt_esc_e (vwm_frame *frame, string_t *buf, int c) {
 }
 
 static string_t *vt_esc_scan (vwm_frame *frame, string_t *buf, int c) {
+  if (c < ' ' and c isnot '\033')
+    frame->counters.num_ctrl++;
+
   switch (c) {
     case '\000': /* NULL (fill character) */
       break;
@@ -2763,6 +3351,8 @@ static void vt_video_add_log_lines (vwm_frame *this) {
 
   int lines = this->num_rows;
 
+  frame_new_gen (this);
+
   for (int i = 0; i < lines; i++)
     for (int j = 0; j < this->num_cols; j++)
       this->videomem[i][j] = 0;
@@ -2806,123 +3396,683 @@ static void vt_video_add_log_lines (vwm_frame *this) {
   munmap (0, st.st_size);
 }
 
-static void frame_on_resize (vwm_frame *this, int rows, int cols) {
-  int **videomem = vwm_alloc_ints (rows, cols, 0);
-  int **colors = vwm_alloc_ints (rows, cols, COLOR_FG_NORMAL);
-  int row_pos = 0;
-  int i, j, nj, ni;
-
-  int last_row = this->num_rows;
-  if (rows < last_row)
-    while (last_row > rows and 0 is this->videomem[last_row-1][0])
-      last_row--;
-
-  for (i = last_row, ni = rows; i and ni; i--, ni--) {
-    if (this->row_pos is i)
-      if ((row_pos = i + (this->num_rows - last_row) + rows - this->num_rows) < 1)
-        row_pos = 1;
-
-    for (j = 0, nj = 0; (j < this->num_cols) and (nj < cols); j++, nj++) {
-      videomem[ni-1][nj] = this->videomem[i-1][j];
-      colors[ni-1][nj] = this->colors[i-1][j];
-    }
-  }
+#define IS_BLANK_CELL(__c__) ((__c__) is 0 or (__c__) is ' ')
 
-  ifnot (row_pos) /* We never reached the old cursor */
-    row_pos = 1;
+/* The lines, from the oldest in the history down to the last that is in
+** use on the screen, are copied to the reflow buffer with their wrapped
+** rows joined, and are written back wrapped at the new width. The rows
+** that don't fit on the screen go to the history, and when the screen
+** grows they come back from there. The slab is reallocated only when it
+** is smaller than the new size, so a storm of resizes doesn't allocate. */
+static void frame_on_resize (vwm_frame *this, int rows, int cols) {
+  /* it will be allocated with the new dimensions */
+  if (NULL is this->videomem) goto set_size;
 
-  this->row_pos = row_pos;
-  this->col_pos = (this->col_pos > cols ? cols : this->col_pos);
+  if (rows is this->num_rows and cols is this->num_cols) return;
 
-  for (i = 0; i < this->num_rows; i++)
-    free (this->videomem[i]);
-  free (this->videomem);
+  frame_new_gen (this);
 
-  for (i = 0; i < this->num_rows; i++)
-    free (this->colors[i]);
-  free (this->colors);
+  vwm_prop *root = this->root->prop;
+  int i, j, k, n;
 
-  this->videomem = videomem;
-  this->colors = colors;
-}
+  int last = this->num_rows;
+  while (last > this->row_pos and last > 1) {
+    for (j = 0; j < this->num_cols; j++)
+      ifnot (IS_BLANK_CELL (this->videomem[last-1][j])) break;
 
-static void win_set_frame (vwm_win *this, vwm_frame *frame) {
-  string_clear (frame->render);
+    if (j < this->num_cols) break;
+    last--;
+  }
 
-  vt_setscroll (frame->render, frame->scroll_first_row + frame->first_row - 1,
-      frame->last_row + frame->first_row - 1);
+  int num_src = this->num_hist + last;
+  size_t cells = (size_t) num_src * this->num_cols;
+  size_t len = cells * 2 + num_src;
 
-  if (this->draw_separators) {
-    this->draw_separators = 0;
-    string_append_with_len (frame->render, this->separators_buf->bytes, this->separators_buf->num_bytes);
+  if (len > root->reflow_len) {
+    root->reflow_len = len + len / 2;
+    root->reflow_buf = Realloc (root->reflow_buf, sizeof (int) * root->reflow_len);
   }
 
-  vt_goto (frame->render, frame->row_pos + frame->first_row - 1, frame->col_pos);
-
-  ifnot (NULL is this->last_frame) {
-    ifnot (frame->key_state is this->last_frame->key_state)
-      vt_keystate_print (frame->render, frame->key_state);
+  int *chars = root->reflow_buf;
+  int *clrs = chars + cells;
+  int *lens = clrs + cells;
+  int num_lines = 0, line_len = 0, cur_line = -1, cur_off = 0;
+  size_t pos = 0;
+
+  for (i = 0; i < num_src; i++) {
+    int idx = (i < this->num_hist ?
+        this->num_rows + this->num_hist - 1 - i : i - this->num_hist);
+    int *row = this->videomem[idx];
+    int wrapped = ROW_WRAPPED (this, row);
+
+    n = this->num_cols;
+    ifnot (wrapped)
+      while (n and IS_BLANK_CELL (row[n-1])) n--;
+
+    if (i >= this->num_hist and idx is this->row_pos - 1) {
+      cur_line = num_lines;
+      cur_off = line_len + this->col_pos - 1;
+    }
 
-    ifnot (frame->textattr is this->last_frame->textattr)
-      vt_attr_set (frame->render, frame->textattr);
+    memcpy (chars + pos, row, sizeof (int) * n);
+    memcpy (clrs + pos, this->colors[idx], sizeof (int) * n);
+    pos += n;
+    line_len += n;
 
-    for (int i = 0; i < NCHARSETS; i++)
-      if (frame->charset[i] isnot this->last_frame->charset[i])
-        vt_altcharset (frame->render, i, frame->charset[i]);
+    ifnot (wrapped) {
+      lens[num_lines++] = line_len;
+      line_len = 0;
+    }
   }
 
-  vt_write (frame->render->bytes, stdout);
-}
+  if (line_len)
+    lens[num_lines++] = line_len;
+
+  /* the rows that the lines need at the new width */
+  int total = 0, cur_row = 0, cur_col = 1;
+  for (i = 0; i < num_lines; i++) {
+    n = lens[i];
+    if (i is cur_line) {
+      if (cur_off >= n) n = cur_off + 1;
+      cur_row = total + cur_off / cols;
+      cur_col = cur_off % cols + 1;
+    }
+
+    total += (n ? (n + cols - 1) / cols : 1);
+  }
+
+  if (rows > this->grid_rows or cols > this->grid_cols) {
+    int grid_rows = this->grid_rows, grid_cols = this->grid_cols;
+    if (rows > grid_rows) grid_rows = rows;
+    if (cols > grid_cols) grid_cols = cols + cols / 4;
+
+    frame_grid_release (this);
+    frame_grid_new (this, grid_rows, grid_cols);
+    this->tabstops = Realloc (this->tabstops, sizeof (int) * grid_cols);
+  } else {
+    for (i = 0; i < this->grid_rows; i++) {
+      this->videomem[i] = this->grid + (size_t) i * this->grid_cols;
+      this->colors[i] = this->grid + ((size_t) this->grid_rows + i) * this->grid_cols;
+    }
+
+    memset (this->wrapped, 0, this->grid_rows);
+  }
+
+  int top = (total > rows ? total - rows : 0);
+
+  /* a cursor above the rows that would go to the history, as vi and less
+  ** leave it, keeps its line on the screen; the rows below that don't fit
+  ** are dropped */
+  if (cur_line isnot -1 and top > cur_row) top = cur_row;
+
+  int num_hist = (top < this->grid_rows - rows ? top : this->grid_rows - rows);
+  int first = top - num_hist;
+  int r = 0;
+
+  pos = 0;
+  for (i = 0; i < num_lines; i++) {
+    n = lens[i];
+    int nrows = (i is cur_line and cur_off >= n ? cur_off + 1 : n);
+    nrows = (nrows ? (nrows + cols - 1) / cols : 1);
+
+    for (k = 0; k < nrows; k++, r++) {
+      if (r < first) continue;
+      if (r >= top + rows) break;
+
+      int idx = (r >= top ? r - top : rows + top - 1 - r);
+      int *row = this->videomem[idx];
+      int *crow = this->colors[idx];
+      int cnt = n - k * cols;
+      if (cnt > cols) cnt = cols;
+      if (cnt < 0) cnt = 0;
+
+      memcpy (row, chars + pos + k * cols, sizeof (int) * cnt);
+      memcpy (crow, clrs + pos + k * cols, sizeof (int) * cnt);
+      for (j = cnt; j < cols; j++) {
+        row[j] = 0;
+        crow[j] = COLOR_FG_NORMAL;
+      }
+
+      ROW_WRAPPED (this, row) = ((k + 1) * cols < n);
+    }
+
+    pos += n;
+  }
+
+  for (i = total - top; i < rows; i++)
+    for (j = 0; j < cols; j++) {
+      this->videomem[i][j] = 0;
+      this->colors[i][j] = COLOR_FG_NORMAL;
+    }
+
+  this->num_hist = num_hist;
+  this->row_pos = (cur_line is -1 ? 1 : cur_row - top + 1);
+  this->col_pos = cur_col;
+
+  /* the parser indexes the rows with these, they have to be on the screen */
+  if (this->row_pos < 1) this->row_pos = 1;
+  if (this->row_pos > rows) this->row_pos = rows;
+
+  if (this->saved_row_pos < 1) this->saved_row_pos = 1;
+  if (this->saved_row_pos > rows) this->saved_row_pos = rows;
+  if (this->saved_col_pos < 1) this->saved_col_pos = 1;
+  if (this->saved_col_pos > cols) this->saved_col_pos = cols;
+
+  /* the tabstops have room for grid_cols */
+  if (cols > this->num_cols) {
+    for (i = this->num_cols; i < cols; i++) {
+      ifnot (i % TABWIDTH)
+        this->tabstops[i] = 1;
+      else
+        this->tabstops[i] = 0;
+    }
+  }
+
+set_size:
+  this->num_rows = rows;
+  this->num_cols = cols;
+  this->last_row = rows;
+}
+
+static void win_set_frame (vwm_win *this, vwm_frame *frame) {
+  string_clear (frame->render);
+
+  vt_setscroll (frame->render, frame->scroll_first_row + frame->first_row - 1,
+      frame->last_row + frame->first_row - 1);
+
+  if (this->draw_separators) {
+    this->draw_separators = 0;
+    string_append_with_len (frame->render, this->separators_buf->bytes, this->separators_buf->num_bytes);
+  }
+
+  vt_goto (frame->render, frame->row_pos + frame->first_row - 1, frame->col_pos);
+
+  ifnot (NULL is this->last_frame) {
+    ifnot (frame->key_state is this->last_frame->key_state)
+      vt_keystate_print (frame->render, frame->key_state);
+
+    ifnot (frame->textattr is this->last_frame->textattr)
+      vt_attr_set (frame->render, frame->textattr);
+
+    for (int i = 0; i < NCHARSETS; i++)
+      if (frame->charset[i] isnot this->last_frame->charset[i])
+        vt_altcharset (frame->render, i, frame->charset[i]);
+  }
+
+  vt_write (frame->root, frame->render);
+}
 
 static void frame_process_output (vwm_frame *this, char *buf, int len) {
   this->process_output_cb (this, buf, len);
 }
 
-#ifndef DEBUG
+static ulong vwm_now_ns (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+#ifdef VWM_TRACE
+#define TRACE_RING_SIZE (1 << 14)
+
+typedef struct trace_event {
+  const char *name;
+  ulong ts;
+  int phase;
+} trace_event;
+
+/* One for each thread that records, and written only by that thread.  The rings
+** are linked once and never freed, so they are walked without locks; the ring
+** of a thread that has exited is taken over by the next, as the spawn workers
+** come and go. */
+typedef struct trace_ring trace_ring;
+
+struct trace_ring {
+  trace_event events[TRACE_RING_SIZE];
+  _Atomic ulong head;
+  _Atomic int in_use;
+  pid_t tid;
+  trace_ring *next;
+};
+
+public int vwm_trace_enabled = 0;
+
+static _Atomic (trace_ring *) trace_rings = NULL;
+static _Thread_local trace_ring *trace_this_ring = NULL;
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static volatile sig_atomic_t trace_need_dump = 0;
+
+static void trace_ring_release (void *ring) {
+  atomic_store (&((trace_ring *) ring)->in_use, 0);
+}
+
+static void trace_key_create (void) {
+  pthread_key_create (&trace_key, trace_ring_release);
+}
+
+static trace_ring *trace_ring_get (void) {
+  pthread_once (&trace_key_once, trace_key_create);
+
+  trace_ring *ring = atomic_load (&trace_rings);
+  while (ring) {
+    int unused = 0;
+    if (atomic_compare_exchange_strong (&ring->in_use, &unused, 1))
+      break;
+
+    ring = ring->next;
+  }
+
+  if (NULL is ring) {
+    ring = Alloc (sizeof (trace_ring));
+    atomic_init (&ring->head, 0);
+    atomic_init (&ring->in_use, 1);
+    ring->next = atomic_load (&trace_rings);
+    while (0 is atomic_compare_exchange_weak (&trace_rings, &ring->next, ring));
+  }
+
+  ring->tid = syscall (SYS_gettid);
+  pthread_setspecific (trace_key, ring);
+  return ring;
+}
+
+public void vwm_trace_event (const char *name, int phase) {
+  trace_ring *ring = trace_this_ring;
+  if (NULL is ring)
+    ring = trace_this_ring = trace_ring_get ();
+
+  ulong head = atomic_load_explicit (&ring->head, memory_order_relaxed);
+  trace_event *ev = &ring->events[head & (TRACE_RING_SIZE - 1)];
+  ev->name = name;
+  ev->ts = vwm_now_ns ();
+  ev->phase = phase;
+  atomic_store_explicit (&ring->head, head + 1, memory_order_release);
+}
+
+static void vwm_trace_signal (int sig) {
+  signal (sig, vwm_trace_signal);
+  trace_need_dump = 1;
+}
+
+static void vwm_set_trace (vwm_t *this, int enable) {
+  (void) this;
+  vwm_trace_enabled = (enable ? 1 : 0);
+}
+
+/* Writes the events of the rings in the Chrome trace event format, which is
+** loaded by chrome://tracing or by Perfetto.  Without a name, the file goes
+** next to the temporary directory, as vwm_trace_<pid>.json. */
+static int vwm_trace_dump (vwm_t *this, char *fname) {
+  char fbuf[PATH_MAX], name[64];
+
+  if (NULL is fname) {
+    snprintf (name, 64, "vwm_trace_%d.json", getpid ());
+    vwm_outside_tmpdir (this, fbuf, PATH_MAX, name);
+    fname = fbuf;
+  }
+
+  FILE *fp = fopen (fname, "w");
+  if (NULL is fp) return NOTOK;
+
+  int pid = getpid ();
+  int num = 0;
+
+  fprintf (fp, "{\"traceEvents\":[");
+
+  trace_ring *ring = atomic_load (&trace_rings);
+  while (ring) {
+    ulong head = atomic_load_explicit (&ring->head, memory_order_acquire);
+    ulong tail = (head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0);
+
+    for (ulong i = tail; i < head; i++) {
+      trace_event *ev = &ring->events[i & (TRACE_RING_SIZE - 1)];
+      fprintf (fp, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lu.%03lu,\"pid\":%d,\"tid\":%d}",
+          (num++ ? "," : ""), ev->name, ev->phase, ev->ts / 1000, ev->ts % 1000, pid, ring->tid);
+    }
+
+    ring = ring->next;
+  }
+
+  fprintf (fp, "\n]}\n");
+
+  return (fclose (fp) ? NOTOK : OK);
+}
+#else
+static void vwm_set_trace (vwm_t *this, int enable) {
+  (void) this; (void) enable;
+}
+
+static int vwm_trace_dump (vwm_t *this, char *fname) {
+  (void) this; (void) fname;
+  return NOTOK;
+}
+#endif /* VWM_TRACE */
+
+/* A frame without a window, that has no output_cb, draws nowhere. */
+static void frame_write (vwm_frame *this) {
+  this->counters.bytes_rendered += this->render->num_bytes;
+
+  ifnot (NULL is this->output_cb) {
+    this->output_cb (this, this->render->bytes, this->render->num_bytes);
+    return;
+  }
+
+  if (NULL is this->parent) return;
+
+  vt_write (this->root, this->render);
+}
+
+static uchar seq_parser_state (vwm_frame *frame) {
+  FrameProcessChar_cb cb = frame->process_char_cb;
+
+  if (cb is vt_esc_e)       return VWM_SEQ_ESC;
+  if (cb is vt_esc_brace)   return VWM_SEQ_CSI;
+  if (cb is vt_esc_brace_q) return VWM_SEQ_CSI_PRIVATE;
+  if (cb is vt_esc_lparen)  return VWM_SEQ_G0_CHARSET;
+  if (cb is vt_esc_rparen)  return VWM_SEQ_G1_CHARSET;
+  if (cb is vt_esc_pound)   return VWM_SEQ_POUND;
+  return VWM_SEQ_TEXT;
+}
+
+static void seq_ring_put (seq_ring *ring, ulong pos, void *src, size_t len) {
+  size_t off = pos & (VWM_SEQ_RING_SIZE - 1);
+  size_t n = VWM_SEQ_RING_SIZE - off;
+  if (n > len) n = len;
+
+  memcpy (ring->bytes + off, src, n);
+  if (len > n)
+    memcpy (ring->bytes, (char *) src + n, len - n);
+}
+
+static void seq_ring_get (seq_ring *ring, ulong pos, void *dest, size_t len) {
+  size_t off = pos & (VWM_SEQ_RING_SIZE - 1);
+  size_t n = VWM_SEQ_RING_SIZE - off;
+  if (n > len) n = len;
+
+  memcpy (dest, ring->bytes + off, n);
+  if (len > n)
+    memcpy ((char *) dest + n, ring->bytes, len - n);
+}
+
+/* The chunk goes in as it was read, after the state that it found.  The
+** oldest records are dropped to make room; a chunk that is bigger than a
+** quarter of the ring is only counted. */
+static void seq_ring_record (seq_ring *ring, vwm_frame *frame, char *buf, int len, ulong ts) {
+  size_t size = sizeof (vwm_seq_record) + len;
+
+  if (size > VWM_SEQ_RING_SIZE / 4) {
+    ring->num_dropped++;
+    return;
+  }
+
+  while (ring->head + size - ring->tail > VWM_SEQ_RING_SIZE) {
+    vwm_seq_record old;
+    seq_ring_get (ring, ring->tail, &old, sizeof (vwm_seq_record));
+    ring->tail += sizeof (vwm_seq_record) + old.len;
+    ring->num_records--;
+    ring->num_dropped++;
+  }
+
+  vwm_seq_record rec = {
+    .ts_ns = ts,
+    .len = len,
+    .frame_id = frame->id,
+    .row_pos = frame->row_pos,
+    .col_pos = frame->col_pos,
+    .num_rows = frame->num_rows,
+    .num_cols = frame->num_cols,
+    .parser = seq_parser_state (frame),
+    .textattr = frame->textattr,
+    .param_idx = frame->param_idx,
+    .mb_len = frame->mb_len
+  };
+
+  seq_ring_put (ring, ring->head, &rec, sizeof (vwm_seq_record));
+  seq_ring_put (ring, ring->head + sizeof (vwm_seq_record), buf, len);
+  ring->head += size;
+  ring->num_records++;
+}
+
 static void frame_process_output_cb (vwm_frame *this, char *buf, int len) {
   string_clear (this->render);
+  frame_new_gen (this);
+
+  ulong t = vwm_now_ns ();
+  this->counters.num_reads++;
+  this->counters.bytes_read += len;
+
+  seq_ring *ring = this->root->prop->sequences;
+  ifnot (NULL is ring)
+    seq_ring_record (ring, this, buf, len, t);
+
+  VWM_TRACE_BEGIN ("parse");
 
   while (len--)
     this->process_char_cb (this, this->render, (uchar) *buf++);
 
-  vt_write (this->render->bytes, stdout);
+  VWM_TRACE_END ("parse");
+
+  ulong t_parsed = vwm_now_ns ();
+  this->counters.parse_ns += t_parsed - t;
+
+  VWM_TRACE_BEGIN ("write");
+  frame_write (this);
+  render_arena_reset (this->render);
+  VWM_TRACE_END ("write");
+
+  this->counters.write_ns += vwm_now_ns () - t_parsed;
 }
-#else
-static void frame_process_output_cb (vwm_frame *this, char *buf, int len) {
-  string_clear (this->render);
 
-  FILE *fout = this->root->prop->sequences_fp;
+/* The output of a frame is recorded by a process_output_cb that is set in
+** front of the one it had.  The records are gathered in blocks, which the
+** thread of the recorder writes, so the frame waits for the disk only when
+** the block before is still being written.  A recorder that is released
+** while another callback was set in front of it, stays to pass the output
+** through, as it can not be unlinked. */
+#define RECORD_BLOCK_SIZE (1 << 16)
+
+typedef struct record_block {
+  char *bytes;
+
+  size_t
+    len,
+    size;
+} record_block;
+
+struct frame_recorder {
+  int
+    fd,
+    is_done,
+    num_errors;
+
+  ulong start_ns;
 
-  fprintf (fout, "\n%s\n\n", buf);
+  FrameProcessOutput_cb process_output_cb;
 
-  char seq_buf[MAX_SEQ_LEN + 1];
-  int seq_idx = 1;
-  seq_buf[0] = '\0';
+  record_block
+    blocks[2],
+    *filling,
+    *writing;
 
-  while (len--) {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
 
-    if (this->process_char_cb is vt_esc_scan) {
-      ifnot (seq_idx) goto proceed;
+static void *frame_recorder_thread (void *arg) {
+  frame_recorder *rec = arg;
 
-      fprintf (fout, "ESC %s\n", seq_buf);
+  pthread_mutex_lock (&rec->mutex);
 
-      seq_idx = 0;
-      memset (seq_buf, 0, MAX_SEQ_LEN+1);
-    } else
-      seq_buf[seq_idx++] = *buf;
+  for (;;) {
+    while (NULL is rec->writing and 0 is rec->is_done)
+      pthread_cond_wait (&rec->cond, &rec->mutex);
 
-proceed:
-    this->process_char_cb (this, this->render, (uchar) *buf++);
+    if (NULL is rec->writing) break;
+
+    record_block *block = rec->writing;
+    pthread_mutex_unlock (&rec->mutex);
+
+    int retval = fd_write (rec->fd, block->bytes, block->len);
+    block->len = 0;
+
+    pthread_mutex_lock (&rec->mutex);
+    if (NOTOK is retval) rec->num_errors++;
+    rec->writing = NULL;
+    pthread_cond_broadcast (&rec->cond);
+  }
+
+  pthread_mutex_unlock (&rec->mutex);
+  return NULL;
+}
+
+/* hands the block that is being filled to the thread */
+static void frame_recorder_flush (frame_recorder *rec) {
+  if (0 is rec->filling->len) return;
+
+  pthread_mutex_lock (&rec->mutex);
+
+  while (NULL isnot rec->writing)
+    pthread_cond_wait (&rec->cond, &rec->mutex);
+
+  rec->writing = rec->filling;
+  rec->filling = (rec->filling is &rec->blocks[0] ? &rec->blocks[1] : &rec->blocks[0]);
+
+  pthread_cond_broadcast (&rec->cond);
+  pthread_mutex_unlock (&rec->mutex);
+}
+
+static void frame_record_output_cb (vwm_frame *this, char *buf, int len) {
+  frame_recorder *rec = this->recorder;
+
+  if (rec->fd is -1) goto theend;
+
+  vwm_rec_record r = {
+    .usec = (vwm_now_ns () - rec->start_ns) / 1000,
+    .len = len,
+    .num_rows = this->num_rows,
+    .num_cols = this->num_cols
+  };
+
+  size_t size = sizeof (vwm_rec_record) + len;
+  record_block *block = rec->filling;
+
+  if (block->len + size > block->size) {
+    frame_recorder_flush (rec);
+    block = rec->filling;
+
+    if (size > block->size) {
+      block->bytes = Realloc (block->bytes, size);
+      block->size = size;
+    }
+  }
+
+  memcpy (block->bytes + block->len, &r, sizeof (vwm_rec_record));
+  memcpy (block->bytes + block->len + sizeof (vwm_rec_record), buf, len);
+  block->len += size;
+
+theend:
+  rec->process_output_cb (this, buf, len);
+}
+
+static void frame_release_record (vwm_frame *this) {
+  frame_recorder *rec = this->recorder;
+  if (NULL is rec or rec->fd is -1) return;
+
+  frame_recorder_flush (rec);
+
+  pthread_mutex_lock (&rec->mutex);
+  rec->is_done = 1;
+  pthread_cond_broadcast (&rec->cond);
+  pthread_mutex_unlock (&rec->mutex);
+
+  pthread_join (rec->thread, NULL);
+  pthread_mutex_destroy (&rec->mutex);
+  pthread_cond_destroy (&rec->cond);
+
+  close (rec->fd);
+  rec->fd = -1;
+
+  for (int i = 0; i < 2; i++) {
+    free (rec->blocks[i].bytes);
+    rec->blocks[i].bytes = NULL;
+  }
+
+  if (this->process_output_cb isnot frame_record_output_cb) return;
+
+  this->process_output_cb = rec->process_output_cb;
+  free (rec);
+  this->recorder = NULL;
+}
+
+/* Starts to record the output of the frame to fname, by default to
+** vwm_record_<pid>_<frame id>.rec next to the temporary directory. */
+static int frame_set_record (vwm_frame *this, char *fname) {
+  vwm_t *root = this->root;
+  char fbuf[PATH_MAX], name[64];
+
+  frame_release_record (this);
+
+  if (NULL is fname) {
+    snprintf (name, 64, "vwm_record_%d_%u.rec", getpid (), this->id);
+    vwm_outside_tmpdir (root, fbuf, PATH_MAX, name);
+    fname = fbuf;
   }
 
-  if (seq_idx)
-    fprintf (fout, "ESC %s\n", seq_buf);
+  int fd = open (fname, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR);
+  if (-1 is fd) return NOTOK;
 
-  fflush (fout);
+  vwm_rec_header hdr = {
+    .version = VWM_REC_VERSION,
+    .byte_order = VWM_REC_BYTEORDER,
+    .num_rows = this->num_rows,
+    .num_cols = this->num_cols,
+    .timestamp = time (NULL)
+  };
+
+  memcpy (hdr.magic, VWM_REC_MAGIC, sizeof (VWM_REC_MAGIC));
+
+  if (NOTOK is fd_write (fd, (char *) &hdr, sizeof (vwm_rec_header))) {
+    close (fd);
+    return NOTOK;
+  }
+
+  frame_recorder *rec = this->recorder;
+
+  if (NULL is rec) {
+    rec = Alloc (sizeof (frame_recorder));
+    rec->process_output_cb = this->process_output_cb;
+    this->process_output_cb = frame_record_output_cb;
+    this->recorder = rec;
+  }
+
+  rec->fd = fd;
+  rec->is_done = 0;
+  rec->num_errors = 0;
+  rec->start_ns = vwm_now_ns ();
+  rec->writing = NULL;
+  rec->filling = &rec->blocks[0];
+
+  for (int i = 0; i < 2; i++) {
+    rec->blocks[i].bytes = Alloc (RECORD_BLOCK_SIZE);
+    rec->blocks[i].size = RECORD_BLOCK_SIZE;
+    rec->blocks[i].len = 0;
+  }
+
+  pthread_mutex_init (&rec->mutex, NULL);
+  pthread_cond_init (&rec->cond, NULL);
+
+  if (0 isnot pthread_create (&rec->thread, NULL, frame_recorder_thread, rec)) {
+    pthread_mutex_destroy (&rec->mutex);
+    pthread_cond_destroy (&rec->cond);
+    for (int i = 0; i < 2; i++) free (rec->blocks[i].bytes);
+    close (fd);
+    rec->fd = -1;
+    return NOTOK;
+  }
 
-  vt_write (this->render->bytes, stdout);
+  return OK;
 }
-#endif /* DEBUG */
 
 static void argv_release (char **argv, int *argc) {
   for (int i = 0; i <= *argc; i++) free (argv[i]);
@@ -2995,6 +4145,11 @@ static void frame_set_command (vwm_frame *this, char *command) {
 }
 
 static void frame_set_visibility (vwm_frame *this, int visibility) {
+  if (NULL is this->parent) goto set_visibility;
+
+  if (this->is_visible isnot (0 isnot visibility))
+    this->parent->render_len = 0;
+
   if (this->is_visible) {
     ifnot (visibility) {
       this->parent->num_visible_frames--;
@@ -3007,6 +4162,7 @@ static void frame_set_visibility (vwm_frame *this, int visibility) {
     }
   }
 
+set_visibility:
   this->is_visible = (0 isnot visibility);
 }
 
@@ -3066,6 +4222,52 @@ static int frame_get_num_rows (vwm_frame *this) {
   return this->num_rows;
 }
 
+static int frame_get_num_cols (vwm_frame *this) {
+  return this->num_cols;
+}
+
+static int frame_get_row_pos (vwm_frame *this) {
+  return this->row_pos;
+}
+
+static int frame_get_col_pos (vwm_frame *this) {
+  return this->col_pos;
+}
+
+static int frame_get_textattr (vwm_frame *this) {
+  return this->textattr;
+}
+
+/* Returns the cell at row, col (from 1) as it is kept, that is the
+** character with the attributes from the ninth bit, and its color in
+** color, or NOTOK when it is out of the grid. */
+static int frame_get_cell (vwm_frame *this, int row, int col, int *color) {
+  if (NULL is this->videomem or
+      row < 1 or row > this->num_rows or col < 1 or col > this->num_cols)
+    return NOTOK;
+
+  if (NULL isnot color)
+    *color = this->colors[row-1][col-1];
+
+  return this->videomem[row-1][col-1];
+}
+
+/* Writes the text of row (from 1) to buf, as it would go to the log.
+** Returns its length, or NOTOK when it doesn't fit or is out of the grid. */
+static int frame_get_line (vwm_frame *this, int row, char *buf, size_t size) {
+  if (NULL is this->videomem or row < 1 or row > this->num_rows)
+    return NOTOK;
+
+  char line[(this->num_cols * 4) + 2];
+  int len = vt_video_line_to_str (this->videomem[row-1], line, this->num_cols) - 1;
+
+  if ((size_t) len >= size) return NOTOK;
+
+  memcpy (buf, line, len);
+  buf[len] = '\0';
+  return len;
+}
+
 static int frame_get_logfd (vwm_frame *this) {
   return this->logfd;
 }
@@ -3078,8 +4280,13 @@ static char *frame_get_logfile (vwm_frame *this) {
 static void frame_clear (vwm_frame *this, int state) {
   if (NULL is this) return;
 
+  frame_alloc_grid (this);
+
   string_t *render = this->render;
 
+  if (state & VFRAME_CLEAR_VIDEO_MEM)
+    frame_new_gen (this);
+
   string_clear (render);
   vt_goto (render, this->first_row, 1);
 
@@ -3093,6 +4300,9 @@ static void frame_clear (vwm_frame *this, int state) {
       string_append_byte (render, ' ');
     }
 
+    if (state & VFRAME_CLEAR_VIDEO_MEM)
+      ROW_WRAPPED (this, this->videomem[i]) = 0;
+
     string_append (render, "\r\n");
   }
 
@@ -3103,7 +4313,7 @@ static void frame_clear (vwm_frame *this, int state) {
     if (this->logfd isnot -1)
       ftruncate (this->logfd, 0);
 
-  vt_write (render->bytes, stdout);
+  frame_write (this);
 }
 
 static int frame_check_pid (vwm_frame *this) {
@@ -3139,6 +4349,10 @@ static int frame_kill_proc (vwm_frame *this) {
   return 0;
 }
 
+static void frame_set_output_cb (vwm_frame *this, FrameOutput_cb cb) {
+  this->output_cb = cb;
+}
+
 static FrameProcessOutput_cb frame_set_process_output_cb (vwm_frame *this, FrameProcessOutput_cb cb) {
   FrameProcessOutput_cb prev = this->process_output_cb;
   this->process_output_cb = cb;
@@ -3193,15 +4407,19 @@ static void frame_unimplemented_default_cb (vwm_frame *this, const char *fun, in
   }
 }
 
+/* the cached render of the frames goes, as soon as the frames change */
 static int win_insert_frame_at (vwm_win *this, vwm_frame *frame, int idx) {
+  this->render_len = 0;
   return DListInsertAt (this, frame, idx);
 }
 
 static int win_append_frame (vwm_win *this, vwm_frame *frame) {
+  this->render_len = 0;
   return DListAppend (this, frame);
 }
 
-static vwm_frame *win_init_frame (vwm_win *this, frame_opts opts) {
+/* A frame with no window, gets its methods from root. */
+static vwm_frame *frame_new (vwm_t *root, vwm_win *this, frame_opts opts) {
   vwm_frame *frame = Alloc (sizeof (vwm_frame));
 
   frame->parent = (opts.parent isnot NULL ? opts.parent : this);
@@ -3210,8 +4428,15 @@ static vwm_frame *win_init_frame (vwm_win *this, frame_opts opts) {
     frame->root = frame->parent->parent;
     frame->win =  frame->parent->self;
     frame->self = frame->parent->frame;
+  } else {
+    frame->root = root;
+    frame->win = root->win;
+    frame->self = root->frame;
   }
 
+  frame->id = ++frame->root->prop->frame_id;
+  frame_new_gen (frame);
+
   frame->pid = opts.pid;
   frame->fd = opts.fd;
   frame->at_frame = opts.at_frame;
@@ -3227,19 +4452,19 @@ static vwm_frame *win_init_frame (vwm_win *this, frame_opts opts) {
     (NULL is this ? 1 : this->first_col));
 
   ifnot (NULL is opts.argv)
-    Vframe.set.argv (frame, opts.argc, opts.argv);
+    frame->self.set.argv (frame, opts.argc, opts.argv);
   else
     if (NULL isnot opts.command)
-      Vframe.set.command (frame, opts.command);
+      frame->self.set.command (frame, opts.command);
 
   frame->logfd = -1;
 
   if (opts.enable_log)
-    Vframe.set.log (frame, opts.logfile, frame->remove_log);
+    frame->self.set.log (frame, opts.logfile, frame->remove_log);
 
   frame->mb_buf[0] = '\0';
   frame->mb_curlen = frame->mb_len = frame->mb_code = 0;
-  frame->render = string_new (2048);
+  frame->render = render_arena_get (&frame->root->prop->renders);
   frame->state = 0;
 
   frame->process_output_cb = (NULL is opts.process_output_cb ?
@@ -3250,29 +4475,29 @@ static vwm_frame *win_init_frame (vwm_win *this, frame_opts opts) {
 
   frame->unimplemented_cb = frame_unimplemented_default_cb;
 
-  frame->videomem = vwm_alloc_ints (frame->num_rows, frame->num_cols, 0);
-  frame->colors = vwm_alloc_ints (frame->num_rows, frame->num_cols, COLOR_FG_NORMAL);
   frame->esc_param = Alloc (sizeof (int) * MAX_PARAMS);
   for (int i = 0; i < MAX_PARAMS; i++) frame->esc_param[i] = 0;
-  frame->tabstops = Alloc (sizeof (int) * frame->num_cols);
-  for (int i = 0; i < frame->num_cols; i++) {
-    ifnot ((int) i % TABWIDTH)
-      frame->tabstops[i] = 1;
-    else
-      frame->tabstops[i] = 0;
-  }
 
-  Vframe.reset (frame);
+  ifnot (opts.lazy)
+    frame_alloc_grid (frame);
+
+  frame->self.reset (frame);
 
-  if (opts.create_fd)
-    Vframe.create_fd (frame);
+  if (opts.create_fd) {
+    frame_alloc_grid (frame);
+    frame->self.create_fd (frame);
+  }
 
   if (opts.fork and frame->argc)
-    Vframe.fork (frame);
+    frame->self.fork (frame);
 
   return frame;
 }
 
+static vwm_frame *win_init_frame (vwm_win *this, frame_opts opts) {
+  return frame_new (NULL, this, opts);
+}
+
 static vwm_frame *win_new_frame (vwm_win *this, frame_opts opts) {
   vwm_frame *frame = self(init_frame, opts);
 
@@ -3301,6 +4526,7 @@ static vwm_frame *win_new_frame (vwm_win *this, frame_opts opts) {
 }
 
 static vwm_frame *win_pop_frame_at (vwm_win *this, int idx) {
+  this->render_len = 0;
   return DListPopAt (this, vwm_frame, idx);
 }
 
@@ -3418,10 +4644,33 @@ static void frame_release_log (vwm_frame *this) {
   this->logfd = -1;
 }
 
-static void win_release_frame_at (vwm_win *this, int idx) {
-  vwm_frame *frame = self(pop_frame_at, idx);
-
-  if (NULL is frame) return;
+static void frame_release (vwm_frame *frame) {
+  frame->self.release_log (frame);
+  frame->self.release_record (frame);
+  free (frame->recorder);
+
+  ifnot (NULL is frame->videomem) {
+    frame_grid_release (frame);
+    free (frame->tabstops);
+  }
+  free (frame->esc_param);
+
+  frame->self.release_argv (frame);
+  free (frame->cwd);
+  render_arena_put (&frame->root->prop->renders, frame->render);
+
+  ifnot (-1 is frame->pid) {
+    kill (frame->pid, SIGHUP);
+    waitpid (frame->pid, NULL, 0);
+  }
+
+  free (frame);
+}
+
+static void win_release_frame_at (vwm_win *this, int idx) {
+  vwm_frame *frame = self(pop_frame_at, idx);
+
+  if (NULL is frame) return;
 
   if (frame->is_visible) {
     this->num_separators--;
@@ -3437,28 +4686,7 @@ static void win_release_frame_at (vwm_win *this, int idx) {
     }
   }
 
-  Vframe.release_log (frame);
-
-  for (int i = 0; i < frame->num_rows; i++)
-    free (frame->videomem[i]);
-  free (frame->videomem);
-
-  for (int i = 0; i < frame->num_rows; i++)
-    free (frame->colors[i]);
-  free (frame->colors);
-
-  free (frame->tabstops);
-  free (frame->esc_param);
-
-  Vframe.release_argv (frame);
-  string_release (frame->render);
-
-  ifnot (-1 is frame->pid) {
-    kill (frame->pid, SIGHUP);
-    waitpid (frame->pid, NULL, 0);
-  }
-
-  free (frame);
+  frame_release (frame);
 }
 
 static void vwm_make_separator (string_t *render, char *color, int cells, int row, int col) {
@@ -3497,7 +4725,7 @@ static int win_set_separators (vwm_win *this, int draw) {
   }
 
   if (DRAW is draw)
-    vt_write (this->separators_buf->bytes, stdout);
+    vt_write (this->parent, this->separators_buf);
 
   return OK;
 }
@@ -3512,6 +4740,32 @@ static vwm_frame *win_set_frame_as_current (vwm_win *this, vwm_frame *frame) {
   return win_set_current_at (this, idx);
 }
 
+/* What the frames part of a window render depends on: the grids, by
+** their generation, and which frames are visible and where. The ids and
+** the generations are never reused, so a frame that takes the place (or
+** the address) of a released one, doesn't match its key. */
+static uint64_t win_render_key (vwm_win *this) {
+  uint64_t key = 14695981039346656037ULL;
+
+  vwm_frame *frame = this->head;
+  while (frame) {
+    ifnot (frame->is_visible) goto next_frame;
+
+    uint64_t v[] = {frame->id, frame->gen,
+        (uint64_t) frame->first_row, (uint64_t) frame->num_rows, (uint64_t) frame->num_cols};
+
+    for (size_t i = 0; i < sizeof (v) / sizeof (v[0]); i++)
+      key = (key ^ v[i]) * 1099511628211ULL;
+
+    next_frame: frame = frame->next;
+  }
+
+  return key;
+}
+
+/* When no frame changed since the last draw, as when switching back and
+** forth between windows, the cached bytes are written again and only the
+** separators and the cursor are made anew. */
 static void win_draw (vwm_win *this) {
   char buf[8];
 
@@ -3525,16 +4779,32 @@ static void win_draw (vwm_win *this) {
   utf8 chr = 0;
 
   string_t *render = this->render;
-  string_clear (render);
+  vwm_frame *frame;
+
+  VWM_TRACE_BEGIN ("draw");
+
+  this->counters.num_draws++;
+
+  uint64_t key = win_render_key (this);
+  if (this->render_len and key is this->render_key) {
+    this->counters.num_cached_draws++;
+    string_clear_at (render, this->render_len);
+    goto draw_cursor;
+  }
+
+  render_arena_reset (render);
   string_append (render, TERM_SCREEN_CLEAR);
   vt_setscroll (render, 0, 0);
   vt_attr_reset (render);
   vt_setbg (render, COLOR_BG_NORM);
   vt_setfg (render, COLOR_FG_NORM);
-  vwm_frame *frame = this->head;
+  frame = this->head;
   while (frame) {
     ifnot (frame->is_visible) goto next_frame;
 
+    frame_alloc_grid (frame);
+    frame->counters.num_redraws++;
+
     vt_goto (render, frame->first_row, 1);
 
     for (int i = 0; i < frame->num_rows; i++) {
@@ -3583,13 +4853,19 @@ static void win_draw (vwm_win *this) {
     next_frame: frame = frame->next;
   }
 
+  this->render_key = key;
+  this->render_len = render->num_bytes;
+
+draw_cursor:
   self(set.separators, DONOT_DRAW);
   string_append_with_len (render, this->separators_buf->bytes, this->separators_buf->num_bytes);
 
   frame = this->current;
   vt_goto (render, frame->row_pos + frame->first_row - 1, frame->col_pos);
 
-  vt_write (render->bytes, stdout);
+  vt_write (this->parent, render);
+
+  VWM_TRACE_END ("draw");
 }
 
 static void win_on_resize (vwm_win *this, int draw) {
@@ -3852,20 +5128,11 @@ static void vwm_change_win (vwm_t *this, vwm_win *win, int dir, int draw) {
 
   Vterm.screen.clear ($my(term));
 
-  ifnot (win->is_initialized) {
-    vwm_frame *frame = win->head;
-    while (frame) {
-      if (frame->argv is NULL)
-        Vframe.set.command (frame, $my(default_app)->bytes);
-
-      Vframe.fork (frame);
-
-      frame = frame->next;
-    }
-  }
+  ifnot (win->is_initialized)
+    vwm_fork_frames (this, win);
 
   if (draw) {
-    if (win->is_initialized)
+    if (win->is_initialized or win->is_restored)
       Vwin.draw (win);
     else
       Vwin.set.separators (win, DRAW);
@@ -3904,6 +5171,8 @@ static int frame_edit_log (vwm_frame *frame) {
   vwm_win *win = frame->parent;
   vwm_t *this = win->parent;
 
+  frame_alloc_grid (frame);
+
   int len;
 
   for (int i = 0; i < frame->num_rows; i++) {
@@ -3912,7 +5181,9 @@ static int frame_edit_log (vwm_frame *frame) {
     write (frame->logfd, buf, len);
   }
 
+  VWM_TRACE_BEGIN ("edit_log");
   $my(edit_file_cb) (this, frame, frame->logfile->bytes, $my(objects)[VWMED_OBJECT]);
+  VWM_TRACE_END ("edit_log");
 
   vt_video_add_log_lines (frame);
   Vwin.draw (win);
@@ -4001,7 +5272,7 @@ static vwm_win *vwm_new_win (vwm_t *this, char *name, win_opts opts) {
   win->num_separators = -1;
 
   win->separators_buf = string_new ((win->num_rows * win->num_cols) + 32);
-  win->render = string_new (4096);
+  win->render = render_arena_get (&$my(renders));
   win->last_row = win->num_rows;
 
   if (win->first_col <= 0) win->first_col = 1;
@@ -4034,6 +5305,9 @@ static vwm_win *vwm_new_win (vwm_t *this, char *name, win_opts opts) {
     fr_opts.num_rows = num_rows;
     fr_opts.first_row = first_row;
 
+    if (opts.lazy)
+      fr_opts.lazy = 1;
+
     Vwin.new_frame (win, fr_opts);
 
     first_row += num_rows + 1;
@@ -4047,260 +5321,1286 @@ static vwm_win *vwm_new_win (vwm_t *this, char *name, win_opts opts) {
     Vwin.draw (win);
   }
 
-  return win;
-}
+  return win;
+}
+
+/* A headless frame: it has no window and no pty, and takes the output
+** that is given to Vframe.process_output(). Its grid is read with the
+** Vframe.get methods, and what it would draw goes to the output_cb that
+** is set with Vframe.set.output_cb(), or nowhere. */
+static vwm_frame *vwm_new_frame (vwm_t *this, frame_opts opts) {
+  if (opts.num_rows <= 0) opts.num_rows = 24;
+  if (opts.num_cols <= 0) opts.num_cols = 80;
+  if (opts.first_row <= 0) opts.first_row = 1;
+  if (opts.first_col <= 0) opts.first_col = 1;
+
+  opts.parent = NULL;
+  opts.fork = 0;
+  opts.create_fd = 0;
+
+  return frame_new (this, NULL, opts);
+}
+
+static void vwm_release_frame (vwm_t *this, vwm_frame *frame) {
+  (void) this;
+  if (NULL is frame or NULL isnot frame->parent) return;
+
+  frame_release (frame);
+}
+
+static void vwm_release_win (vwm_t *this, vwm_win *win) {
+  int idx = self(get.win_idx, win);
+  if (idx is NOTOK) return;
+
+  vwm_win *w = self(pop_win_at, idx);
+
+  int len = w->length;
+  for (int i = 0; i < len; i++)
+    Vwin.release_frame_at (w, 0);
+
+  string_release (win->separators_buf);
+  render_arena_put (&$my(renders), win->render);
+
+  if ($my(last_win) is w and $my(length) isnot 0) {
+    if ($my(length) is 1)
+      $my(last_win) = $my(current);
+    else {
+      vwm_win *lw = $my(head);
+      while (lw) {
+        if (lw isnot $my(current)) {
+          $my(last_win) = lw;
+          break;
+        }
+
+        lw = lw->next;
+      }
+    }
+  }
+
+  free (w->name);
+  free (w);
+}
+
+static int vwm_spawn (vwm_t *this, char **argv) {
+  int status = NOTOK;
+  pid_t pid;
+
+  Vterm.orig_mode ($my(term));
+
+  if (-1 is (pid = fork ())) goto theend;
+
+  ifnot (pid) {
+    char lrows[4], lcols[4];
+    snprintf (lrows, 4, "%d", $my(num_rows));
+    snprintf (lcols, 4, "%d", $my(num_cols));
+
+    setenv ("TERM", $my(term)->name, 1);
+    setenv ("LINES", lrows, 1);
+    setenv ("COLUMNS", lcols, 1);
+
+    execvp (argv[0], argv);
+    fprintf (stderr, "execvp failed\n");
+    _exit (1);
+  }
+
+  if (-1 is waitpid (pid, &status, 0)) {
+    status = -1;
+    goto theend;
+  }
+
+  ifnot (WIFEXITED (status)) {
+    status = -1;
+    fprintf (stderr, "Failed to invoke %s\n", argv[0]);
+    goto theend;
+  }
+
+  ifnot (status is WEXITSTATUS (status))
+    fprintf (stderr, "Proc %s terminated with exit status: %d", argv[0], status);
+
+theend:
+  Vterm.raw_mode ($my(term));
+  return status;
+}
+
+static int frame_create_fd (vwm_frame *frame) {
+  if (frame->fd isnot -1) return frame->fd;
+
+  int fd = -1;
+  if (-1 is (fd = posix_openpt (O_RDWR|O_NOCTTY|O_CLOEXEC))) goto theerror;
+  if (-1 is grantpt (fd)) goto theerror;
+  if (-1 is unlockpt (fd)) goto theerror;
+  char *name = ptsname (fd); ifnull (name) goto theerror;
+  cstring_cp (frame->tty_name, MAX_TTYNAME, name, MAX_TTYNAME - 1);
+
+  frame->fd = fd;
+  return fd;
+
+theerror:
+  if (fd isnot -1)
+    close (fd);
+
+  return -1;
+}
+
+/* A command that runs on its own does not need a copy of this process,
+** with its grids and scrollback, so it is started with posix_spawn(),
+** that is a vfork() underneath. The tty is opened after setsid(), so it
+** becomes the controlling one. */
+static pid_t pty_spawn (vwm_t *this, int fd, char *tty_name, char **argv,
+                             int num_rows, int num_cols, char *vwm_pid, char *cwd) {
+  extern char **environ;
+
+  int num = 0;
+  while (environ[num]) num++;
+
+  char
+    term[256],
+    rows[32],
+    cols[32],
+    vwm[32],
+    **envp = Alloc (sizeof (char *) * (num + 5));
+
+  snprintf (term, sizeof (term), "TERM=%s", $my(term)->name);
+  snprintf (rows, sizeof (rows), "LINES=%d", num_rows);
+  snprintf (cols, sizeof (cols), "COLUMNS=%d", num_cols);
+  snprintf (vwm, sizeof (vwm), "VWM=%s", vwm_pid);
+
+  int idx = 0;
+  envp[idx++] = term;
+  envp[idx++] = rows;
+  envp[idx++] = cols;
+  envp[idx++] = vwm;
+
+  for (int i = 0; i < num; i++) {
+    char *e = environ[i];
+    if (0 is strncmp (e, "TERM=", 5) or 0 is strncmp (e, "LINES=", 6) or
+        0 is strncmp (e, "COLUMNS=", 8) or 0 is strncmp (e, "VWM=", 4))
+      continue;
+
+    envp[idx++] = e;
+  }
+
+  envp[idx] = NULL;
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init (&attr);
+  posix_spawnattr_setflags (&attr,
+      POSIX_SPAWN_SETSID|POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSIGDEF);
+
+  sigset_t sigset;
+  sigemptyset (&sigset);
+  posix_spawnattr_setsigmask (&attr, &sigset);
+  sigfillset (&sigset);
+  posix_spawnattr_setsigdefault (&attr, &sigset);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init (&actions);
+  posix_spawn_file_actions_addopen (&actions, 0, tty_name, O_RDWR, 0);
+  posix_spawn_file_actions_adddup2 (&actions, 0, 1);
+  posix_spawn_file_actions_adddup2 (&actions, 0, 2);
+#if defined (__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+  posix_spawn_file_actions_addclosefrom_np (&actions, 3);
+#endif
+#if HAVE_SPAWN_CHDIR
+  if (NULL isnot cwd)
+    posix_spawn_file_actions_addchdir_np (&actions, cwd);
+#else
+  (void) cwd;
+#endif
+
+  fd_set_size (fd, num_rows, num_cols);
+
+  pid_t pid;
+  int retval = posix_spawnp (&pid, argv[0], &actions, &attr, argv, envp);
+
+  posix_spawn_file_actions_destroy (&actions);
+  posix_spawnattr_destroy (&attr);
+  free (envp);
+
+  if (retval) {
+    errno = retval;
+    return -1;
+  }
+
+  return pid;
+}
+
+static int pty_new (char *tty_name) {
+  int fd = posix_openpt (O_RDWR|O_NOCTTY|O_CLOEXEC);
+  if (-1 is fd) return -1;
+
+  char *name;
+  if (-1 is grantpt (fd) or -1 is unlockpt (fd) or NULL is (name = ptsname (fd))) {
+    close (fd);
+    return -1;
+  }
+
+  cstring_cp (tty_name, MAX_TTYNAME, name, MAX_TTYNAME - 1);
+  return fd;
+}
+
+/* Started at the full size of the screen, as with a new window; the
+** environment keeps that size in LINES and COLUMNS. */
+static void vwm_pool_fill (vwm_t *this) {
+  char pid[8]; snprintf (pid, sizeof (pid), "%d", getpid ());
+
+  if (NULL is $my(pool_argv))
+    $my(pool_argv) = parse_command ($my(default_app)->bytes, &$my(pool_argc));
+
+  while ($my(pool_len) < $my(pool_size)) {
+    pool_pty *p = &$my(pool)[$my(pool_len)];
+
+    if (-1 is (p->fd = pty_new (p->tty_name)))
+      goto theerror;
+
+    if (-1 is (p->pid = pty_spawn (this, p->fd, p->tty_name, $my(pool_argv),
+        $my(num_rows), $my(num_cols), pid, NULL))) {
+      close (p->fd);
+      goto theerror;
+    }
+
+    $my(pool_len)++;
+  }
+
+  return;
+
+theerror:
+  /* don't try again on every wakeup */
+  $my(pool_size) = $my(pool_len);
+}
+
+static int vwm_pool_take (vwm_t *this, vwm_frame *frame) {
+  if (NULL is $my(pool_argv) or frame->argc isnot $my(pool_argc))
+    return NOTOK;
+
+  for (int i = 0; i < frame->argc; i++)
+    if (0 isnot strcmp (frame->argv[i], $my(pool_argv)[i]))
+      return NOTOK;
+
+  while ($my(pool_len)) {
+    pool_pty *p = &$my(pool)[--$my(pool_len)];
+
+    /* it might have exited while it was waiting */
+    if (0 isnot waitpid (p->pid, NULL, WNOHANG)) {
+      close (p->fd);
+      continue;
+    }
+
+    frame->fd = p->fd;
+    frame->pid = p->pid;
+    cstring_cp (frame->tty_name, MAX_TTYNAME, p->tty_name, MAX_TTYNAME - 1);
+
+    /* the kernel signals the shell, if this is a new size */
+    fd_set_size (frame->fd, frame->num_rows, frame->num_cols);
+    return OK;
+  }
+
+  return NOTOK;
+}
+
+/* The at_fork_cb of a frame might run code of this process in the
+** child, so only the default one takes the fast path. */
+static int frame_can_spawn (vwm_frame *frame) {
+  return (frame->at_fork_cb is frame_at_fork_default_cb and frame->argv isnot NULL and
+         (frame->cwd is NULL or HAVE_SPAWN_CHDIR));
+}
+
+static pid_t frame_fork (vwm_frame *frame) {
+  if (frame->pid isnot -1)
+    return frame->pid;
+
+  VWM_TRACE_BEGIN ("fork");
+
+  frame_alloc_grid (frame);
+
+  char pid[8]; snprintf (pid, sizeof (pid), "%d", getpid ());
+
+  vwm_t *this = frame->parent->parent;
+
+  signal (SIGWINCH, SIG_IGN);
+
+  frame->pid = -1;
+
+  if (frame->fd is -1 and frame->at_fork_cb is frame_at_fork_default_cb and
+      frame->argv isnot NULL and frame->cwd is NULL and
+      OK is vwm_pool_take (this, frame))
+    goto theend;
+
+  int fd = -1;
+
+  if (frame->fd is -1) {
+    if (-1 is (fd = posix_openpt (O_RDWR|O_NOCTTY|O_CLOEXEC))) goto theerror;
+    if (-1 is grantpt (fd)) goto theerror;
+    if (-1 is unlockpt (fd)) goto theerror;
+    char *name = ptsname (fd); ifnull (name) goto theerror;
+    cstring_cp (frame->tty_name, MAX_TTYNAME, name, MAX_TTYNAME - 1);
+  } else
+    fd = frame->fd;
+
+  frame->fd = fd;
+
+  if (frame_can_spawn (frame)) {
+    if (-1 is (frame->pid = pty_spawn (this, fd, frame->tty_name, frame->argv,
+        frame->num_rows, frame->num_cols, pid, frame->cwd)))
+      goto theerror;
+
+    goto theend;
+  }
+
+  if (-1 is (frame->pid = fork ())) goto theerror;
+
+  ifnot (frame->pid) {
+    int slave_fd;
+
+    setsid ();
+
+    if (-1 is (slave_fd = open (frame->tty_name, O_RDWR|O_CLOEXEC|O_NOCTTY)))
+      goto theerror;
+
+    ioctl (slave_fd, TIOCSCTTY, 0);
+
+    dup2 (slave_fd, 0);
+    dup2 (slave_fd, 1);
+    dup2 (slave_fd, 2);
+
+    fd_set_size (slave_fd, frame->num_rows, frame->num_cols);
+
+    close (slave_fd);
+    close (fd);
+
+    fd_close_from (3);
+
+    sigset_t emptyset;
+    sigemptyset (&emptyset);
+    sigprocmask (SIG_SETMASK, &emptyset, NULL);
+
+    char rows[4]; snprintf (rows, 4, "%d", frame->num_rows);
+    char cols[4]; snprintf (cols, 4, "%d", frame->num_cols);
+    setenv ("TERM",  $my(term)->name, 1);
+    setenv ("LINES", rows, 1);
+    setenv ("COLUMNS", cols, 1);
+    setenv ("VWM", pid, 1);
+
+    if (NULL isnot frame->cwd)
+      if (-1 is chdir (frame->cwd)) {}
+
+    frame->pid = getpid ();
+
+    int retval = frame->at_fork_cb (frame, this, frame->parent);
+
+    if (retval is NOTOK)
+      goto theerror;
+
+    ifnot (retval)
+      return 0;
+
+    if (retval is 1) {
+      execvp (frame->argv[0], frame->argv);
+
+      fprintf (stderr, "execvp() failed for command: '%s'\n", frame->argv[0]);
+      _exit (1);
+    }
+  }
+
+  goto theend;
+
+theerror:
+  ifnot (-1 is frame->pid) {
+    kill (frame->pid, SIGHUP);
+    waitpid (frame->pid, NULL, 0);
+  }
+
+  frame->pid = -1;
+  frame->fd = -1;
+
+  ifnot (-1 is fd) close (fd);
+
+theend:
+  signal (SIGWINCH, vwm_sigwinch_handler);
+  VWM_TRACE_END ("fork");
+  return frame->pid;
+}
+
+typedef struct spawn_batch {
+  vwm_t *root;
+  vwm_frame **frames;
+  int num_frames;
+  atomic_int next;
+  char vwm_pid[8];
+} spawn_batch;
+
+static void *vwm_spawn_worker (void *arg) {
+  spawn_batch *batch = arg;
+  vwm_t *this = batch->root;
+
+  int idx;
+  while ((idx = atomic_fetch_add (&batch->next, 1)) < batch->num_frames) {
+    vwm_frame *frame = batch->frames[idx];
+    VWM_TRACE_BEGIN ("spawn");
+    frame->pid = pty_spawn (this, frame->fd, frame->tty_name, frame->argv,
+        frame->num_rows, frame->num_cols, batch->vwm_pid, frame->cwd);
+    VWM_TRACE_END ("spawn");
+  }
+
+  return NULL;
+}
+
+/* Starts the frames of win that are not running yet.  The ptys are opened
+** here, one after the other, while the processes are spawned by up to
+** VWM_SPAWN_THREADS threads at once.  They are all joined before return,
+** so the window can be drawn right after. */
+static void vwm_fork_frames (vwm_t *this, vwm_win *win) {
+  vwm_frame *frames[win->length + 1];
+
+  spawn_batch batch = {.root = this, .frames = frames, .num_frames = 0};
+  atomic_init (&batch.next, 0);
+  snprintf (batch.vwm_pid, sizeof (batch.vwm_pid), "%d", getpid ());
+
+  vwm_frame *frame = win->head;
+  while (frame) {
+    if (frame->argv is NULL)
+      Vframe.set.command (frame, $my(default_app)->bytes);
+
+    if (frame->pid isnot -1) goto next_frame;
+
+    ifnot (frame_can_spawn (frame)) {
+      Vframe.fork (frame);
+      goto next_frame;
+    }
+
+    frame_alloc_grid (frame);
+
+    if (frame->fd is -1) {
+      if (frame->cwd is NULL and OK is vwm_pool_take (this, frame))
+        goto next_frame;
+
+      if (-1 is (frame->fd = pty_new (frame->tty_name)))
+        goto next_frame;
+    }
+
+    frames[batch.num_frames++] = frame;
+
+next_frame:
+    frame = frame->next;
+  }
+
+  ifnot (batch.num_frames) return;
+
+  signal (SIGWINCH, SIG_IGN);
+
+  int num_threads = (batch.num_frames < VWM_SPAWN_THREADS ? batch.num_frames : VWM_SPAWN_THREADS) - 1;
+  pthread_t threads[VWM_SPAWN_THREADS];
+
+  int started = 0;
+  for (; started < num_threads; started++)
+    if (0 isnot pthread_create (&threads[started], NULL, vwm_spawn_worker, &batch))
+      break;
+
+  vwm_spawn_worker (&batch);
+
+  for (int i = 0; i < started; i++)
+    pthread_join (threads[i], NULL);
+
+  for (int i = 0; i < batch.num_frames; i++) {
+    frame = frames[i];
+    if (frame->pid is -1) {
+      close (frame->fd);
+      frame->fd = -1;
+    }
+  }
+
+  signal (SIGWINCH, vwm_sigwinch_handler);
+}
+
+static void vwm_sigwinch_handler (int sig) {
+  signal (sig, vwm_sigwinch_handler);
+  vwm_t *this = VWM;
+  $my(need_resize) = 1;
+}
+
+static void vwm_sigchld_handler (int sig) {
+  signal (sig, vwm_sigchld_handler);
+  vwm_t *this = VWM;
+  int saved_errno = errno;
+  char c = 0;
+  write ($my(sigchld_fd)[1], &c, 1);
+  errno = saved_errno;
+}
+
+static int vwm_get_sigchld_fd (vwm_t *this) {
+  return $my(sigchld_fd)[0];
+}
+
+/* Drains the pipe; the frames are checked by whoever waits for them. */
+static void vwm_handle_sigchld (vwm_t *this) {
+  char buf[64];
+  while (0 < read ($my(sigchld_fd)[0], buf, sizeof (buf)));
+  $my(need_reap) = 1;
+}
+
+/* Spreads the rows of the screen over the visible frames of win. */
+static void vwm_layout_win (vwm_t *this, vwm_win *win) {
+  win->num_rows = $my(num_rows);
+  win->num_cols = $my(num_cols);
+  win->last_row = win->num_rows;
+  win->need_layout = 0;
+
+  int frame_rows = 0;
+  int num_frames = Vwin.get.num_visible_frames (win);
+  int mod = Vwin.frame_rows (win, num_frames, &frame_rows);
+
+  int
+    num_rows = frame_rows + mod,
+    first_row = win->first_row;
+
+  vwm_frame *frame = win->head;
+  while (frame) {
+    Vframe.on_resize (frame, num_rows, win->num_cols);
+
+    frame->first_row = first_row;
+    frame->num_rows = num_rows;
+    frame->num_cols = win->num_cols;
+    frame->last_row = frame->num_rows;
+
+    if (frame->argv and frame->pid isnot -1) {
+      struct winsize ws = {.ws_row = frame->num_rows, .ws_col = frame->num_cols};
+      ioctl (frame->fd, TIOCSWINSZ, &ws);
+      kill (frame->pid, SIGWINCH);
+    }
+
+    if (frame->is_visible) {
+      first_row += num_rows + 1;
+      num_rows = frame_rows;
+    }
+
+    frame = frame->next;
+  }
+}
+
+/* Only the current window is resized at once. The others keep their
+** geometry, and their frames keep parsing on it, until they are shown. */
+static void vwm_resize (vwm_t *this, int rows, int cols) {
+  self(set.size, rows, cols, 1);
+
+  vwm_win *win = $my(head);
+  while (win) {
+    win->need_layout = 1;
+    win = win->next;
+  }
+
+  win = $my(current);
+
+  if (win) {
+    vwm_layout_win (this, win);
+    Vwin.draw (win);
+  }
+
+  $my(need_resize) = 0;
+  $my(resize_at) = 0;
+  $my(resize_rows) = 0;
+}
+
+/* Like a SIGWINCH, for when the size doesn't come from the terminal.
+** Returns NOTOK when this is already the size and none is pending. */
+static int vwm_queue_resize (vwm_t *this, int rows, int cols) {
+  if (rows is $my(num_rows) and cols is $my(num_cols) and
+      0 is $my(need_resize) and 0 is $my(resize_at))
+    return NOTOK;
+
+  $my(resize_rows) = rows;
+  $my(resize_cols) = cols;
+  $my(need_resize) = 1;
+  return OK;
+}
+
+static long vwm_now_ms (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void vwm_handle_sigwinch (vwm_t *this) {
+  VWM_TRACE_BEGIN ("sigwinch");
+  int rows; int cols;
+  Vterm.init_size ($my(term), &rows, &cols);
+  vwm_resize (this, rows, cols);
+  VWM_TRACE_END ("sigwinch");
+}
+
+/* The signals that arrive within VWM_RESIZE_DELAY from the first one,
+** as when the edge of the terminal is dragged, end up in a single
+** resize. Returns the milliseconds to wait for, or -1 if none is due. */
+static long vwm_check_resize (vwm_t *this) {
+  long now = vwm_now_ms ();
+
+  if ($my(need_resize)) {
+    $my(need_resize) = 0;
+    ifnot ($my(resize_at))
+      $my(resize_at) = now + VWM_RESIZE_DELAY;
+  }
+
+  ifnot ($my(resize_at)) return -1;
+
+  if (now < $my(resize_at))
+    return $my(resize_at) - now;
+
+  if ($my(resize_rows))
+    vwm_resize (this, $my(resize_rows), $my(resize_cols));
+  else
+    vwm_handle_sigwinch (this);
+
+  return -1;
+}
+
+static void snapshot_pad (FILE *fp, size_t len) {
+  static const char zeros[8];
+  fwrite (zeros, 1, SNAPSHOT_ALIGN (len) - len, fp);
+}
+
+static void snapshot_write (FILE *fp, const void *buf, size_t len) {
+  fwrite (buf, 1, len, fp);
+  snapshot_pad (fp, len);
+}
+
+static void snapshot_write_frame (vwm_frame *frame, FILE *fp, int flags) {
+  snap_frame sf;
+  memset (&sf, 0, sizeof (snap_frame));
+
+  sf.num_rows = frame->num_rows;
+  sf.num_cols = frame->num_cols;
+  sf.first_row = frame->first_row;
+  sf.last_row = frame->last_row;
+  sf.row_pos = frame->row_pos;
+  sf.col_pos = frame->col_pos;
+  sf.saved_row_pos = frame->saved_row_pos;
+  sf.saved_col_pos = frame->saved_col_pos;
+  sf.scroll_first_row = frame->scroll_first_row;
+  sf.key_state = frame->key_state;
+  sf.is_visible = frame->is_visible;
+  sf.remove_log = frame->remove_log;
+  sf.charset[G0] = frame->charset[G0];
+  sf.charset[G1] = frame->charset[G1];
+  sf.textattr = frame->textattr;
+  sf.saved_textattr = frame->saved_textattr;
+  sf.argc = frame->argc;
+
+  for (int i = 0; i < frame->argc; i++)
+    sf.argv_len += bytelen (frame->argv[i]) + 1;
+
+  /* where the shell was left, rather than where it was started */
+  char cwd[PATH_MAX];
+  cwd[0] = '\0';
+  if (frame->pid isnot -1) {
+    char link[64];
+    snprintf (link, sizeof (link), "/proc/%d/cwd", frame->pid);
+    ssize_t len = readlink (link, cwd, PATH_MAX - 1);
+    cwd[len > 0 ? len : 0] = '\0';
+  }
+
+  if (cwd[0] is '\0' and NULL isnot frame->cwd)
+    cstring_cp (cwd, PATH_MAX, frame->cwd, PATH_MAX - 1);
+
+  if (cwd[0])
+    sf.cwd_len = bytelen (cwd) + 1;
+
+  if (NULL isnot frame->logfile)
+    sf.logfile_len = frame->logfile->num_bytes + 1;
+
+  if (NULL isnot frame->videomem) {
+    sf.grid_rows = frame->num_rows;
+    sf.grid_cols = frame->num_cols;
+  }
+
+  struct stat st;
+  if ((flags & VWM_SNAPSHOT_LOG) and frame->logfd isnot -1 and
+      0 is fstat (frame->logfd, &st))
+    sf.log_len = st.st_size;
+
+  snapshot_write (fp, &sf, sizeof (snap_frame));
+
+  char argv[sf.argv_len + 1];
+  size_t len = 0;
+  for (int i = 0; i < frame->argc; i++) {
+    size_t alen = bytelen (frame->argv[i]) + 1;
+    memcpy (argv + len, frame->argv[i], alen);
+    len += alen;
+  }
+  snapshot_write (fp, argv, sf.argv_len);
+
+  if (sf.cwd_len)
+    snapshot_write (fp, cwd, sf.cwd_len);
+
+  if (sf.logfile_len)
+    snapshot_write (fp, frame->logfile->bytes, sf.logfile_len);
+
+  for (uint32_t i = 0; i < sf.grid_rows; i++)
+    fwrite (frame->videomem[i], sizeof (int), sf.grid_cols, fp);
+
+  for (uint32_t i = 0; i < sf.grid_rows; i++)
+    fwrite (frame->colors[i], sizeof (int), sf.grid_cols, fp);
+
+  snapshot_pad (fp, (size_t) sf.grid_rows * sf.grid_cols * sizeof (int) * 2);
+
+  if (sf.log_len) {
+    char buf[BUFSIZE];
+    uint64_t left = sf.log_len;
+    off_t off = 0;
+    ssize_t nread;
+    while (left and 0 < (nread = pread (frame->logfd, buf,
+        (left < BUFSIZE ? left : BUFSIZE), off))) {
+      fwrite (buf, 1, nread, fp);
+      left -= nread;
+      off += nread;
+    }
+
+    /* keep the sizes that were announced, if the log shrunk meanwhile */
+    while (left--) fputc ('\0', fp);
+
+    snapshot_pad (fp, sf.log_len);
+  }
+}
+
+/* Writes the windows, frames and screens to fname, through a temporary
+** file that is renamed over it.  With VWM_SNAPSHOT_LOG in flags, the logs
+** of the frames (their scrollback) are included. */
+static int vwm_save_snapshot (vwm_t *this, char *fname, int flags) {
+  if (NULL is fname) return NOTOK;
+
+  size_t len = bytelen (fname);
+  char tmp[len + 8];
+  snprintf (tmp, len + 8, "%s.XXXXXX", fname);
+
+  int fd = mkstemp (tmp);
+  if (-1 is fd) return NOTOK;
+
+  FILE *fp = fdopen (fd, "w");
+  if (NULL is fp) {
+    close (fd);
+    unlink (tmp);
+    return NOTOK;
+  }
+
+  char cwd[PATH_MAX];
+  if (NULL is getcwd (cwd, PATH_MAX)) cwd[0] = '\0';
+
+  snap_header hdr;
+  memset (&hdr, 0, sizeof (snap_header));
+  memcpy (hdr.magic, SNAPSHOT_MAGIC, sizeof (SNAPSHOT_MAGIC));
+  hdr.version = SNAPSHOT_VERSION;
+  hdr.byte_order = SNAPSHOT_BYTEORDER;
+  hdr.num_rows = $my(num_rows);
+  hdr.num_cols = $my(num_cols);
+  hdr.num_wins = $my(length);
+  hdr.cur_win_idx = ($my(cur_idx) < 0 ? 0 : $my(cur_idx));
+  hdr.cwd_len = bytelen (cwd) + 1;
+  hdr.flags = flags;
+
+  snapshot_write (fp, &hdr, sizeof (snap_header));
+  snapshot_write (fp, cwd, hdr.cwd_len);
+
+  vwm_win *win = $my(head);
+  while (win) {
+    snap_win sw;
+    sw.num_frames = win->length;
+    sw.max_frames = win->max_frames;
+    sw.cur_frame_idx = (win->cur_idx < 0 ? 0 : win->cur_idx);
+    sw.name_len = bytelen (win->name) + 1;
+
+    snapshot_write (fp, &sw, sizeof (snap_win));
+    snapshot_write (fp, win->name, sw.name_len);
+
+    vwm_frame *frame = win->head;
+    while (frame) {
+      snapshot_write_frame (frame, fp, flags);
+      frame = frame->next;
+    }
+
+    win = win->next;
+  }
+
+  int failed = ferror (fp);
+  if (EOF is fclose (fp)) failed = 1;
+
+  if (failed or -1 is rename (tmp, fname)) {
+    unlink (tmp);
+    return NOTOK;
+  }
+
+  return OK;
+}
+
+/* Returns the next len bytes of the mapping and moves past them and their
+** padding, or NULL if the file is shorter than that. */
+static char *snapshot_take (char **cur, char *end, size_t len) {
+  if ((size_t) (end - *cur) < len) return NULL;
+  char *p = *cur;
+  size_t alen = SNAPSHOT_ALIGN (len);
+  *cur += ((size_t) (end - *cur) < alen ? (size_t) (end - *cur) : alen);
+  return p;
+}
+
+static int snapshot_read_frame (vwm_t *this, vwm_frame *frame, char **cur, char *end,
+                                                             int same_size) {
+  snap_frame *sf = (snap_frame *) snapshot_take (cur, end, sizeof (snap_frame));
+  if (NULL is sf) return NOTOK;
+
+  char *argv = snapshot_take (cur, end, sf->argv_len);
+  char *cwd = snapshot_take (cur, end, sf->cwd_len);
+  char *logfile = snapshot_take (cur, end, sf->logfile_len);
+  size_t grid_size = (size_t) sf->grid_rows * sf->grid_cols * sizeof (int);
+  int *grid = (int *) snapshot_take (cur, end, grid_size * 2);
+  char *log = snapshot_take (cur, end, sf->log_len);
+
+  if (NULL is argv or NULL is cwd or NULL is logfile or NULL is grid or NULL is log)
+    return NOTOK;
+
+  if (sf->cwd_len and cwd[sf->cwd_len - 1] is '\0') {
+    free (frame->cwd);
+    frame->cwd = strdup (cwd);
+  }
+
+  if (sf->argc and sf->argv_len and argv[sf->argv_len - 1] is '\0') {
+    /* every argument takes at least its NUL */
+    uint32_t max = (sf->argc < sf->argv_len ? sf->argc : sf->argv_len);
+    if (max > MAX_ARGS - 1) max = MAX_ARGS - 1;
+
+    char *largv[MAX_ARGS];
+    char *p = argv;
+    uint32_t argc = 0;
+    while (argc < max and p < argv + sf->argv_len) {
+      largv[argc++] = p;
+      p += bytelen (p) + 1;
+    }
+    largv[argc] = NULL;
+    Vframe.set.argv (frame, argc, largv);
+  }
+
+  /* the layout that has been just computed is kept, unless the saved
+  ** one fits the screen */
+  if (same_size and sf->num_rows >= 1 and sf->first_row >= 1 and
+      sf->num_rows <= $my(num_rows) - sf->first_row + 1) {
+    frame->num_rows = sf->num_rows;
+    frame->first_row = sf->first_row;
+    frame->last_row = (sf->last_row < 1 or sf->last_row > sf->num_rows
+        ? sf->num_rows : sf->last_row);
+  }
+
+  frame->saved_row_pos = (sf->saved_row_pos < 1 ? 1 :
+      (sf->saved_row_pos > frame->num_rows ? frame->num_rows : sf->saved_row_pos));
+  frame->saved_col_pos = (sf->saved_col_pos < 1 ? 1 :
+      (sf->saved_col_pos > frame->num_cols ? frame->num_cols : sf->saved_col_pos));
+  frame->key_state = sf->key_state;
+  frame->charset[G0] = sf->charset[G0];
+  frame->charset[G1] = sf->charset[G1];
+  frame->textattr = sf->textattr;
+  frame->saved_textattr = sf->saved_textattr;
+
+  if (sf->scroll_first_row >= 1 and sf->scroll_first_row <= frame->num_rows)
+    frame->scroll_first_row = sf->scroll_first_row;
+
+  if (sf->log_len) {
+    if (-1 isnot Vframe.set.log (frame, NULL, sf->remove_log))
+      fd_write (frame->logfd, log, sf->log_len);
+  } else if (sf->logfile_len and logfile[sf->logfile_len - 1] is '\0')
+    Vframe.set.log (frame, logfile, sf->remove_log);
+
+  /* a frame that had no grid, stays a placeholder */
+  ifnot (sf->grid_rows) return OK;
+
+  frame_alloc_grid (frame);
+
+  /* as with a resize, the bottom rows are kept */
+  int *colors = grid + (size_t) sf->grid_rows * sf->grid_cols;
+  int rows = (int) sf->grid_rows;
+  int cols = ((int) sf->grid_cols < frame->num_cols ? (int) sf->grid_cols : frame->num_cols);
+  int skip = (rows > frame->num_rows ? rows - frame->num_rows : 0);
+
+  for (int i = skip, ni = frame->num_rows - (rows - skip); i < rows; i++, ni++) {
+    memcpy (frame->videomem[ni], grid + (size_t) i * sf->grid_cols, cols * sizeof (int));
+    memcpy (frame->colors[ni], colors + (size_t) i * sf->grid_cols, cols * sizeof (int));
+  }
+
+  int row_pos = sf->row_pos - skip + (frame->num_rows - (rows - skip));
+  frame->row_pos = (row_pos < 1 ? 1 : (row_pos > frame->num_rows ? frame->num_rows : row_pos));
+  frame->col_pos = (sf->col_pos < 1 ? 1 : (sf->col_pos > frame->num_cols ? frame->num_cols : sf->col_pos));
+
+  return OK;
+}
+
+/* Walks the records of a frame, so that nothing is created from a file
+** that is truncated or damaged. */
+static int snapshot_check_frame (char **cur, char *end) {
+  snap_frame *sf = (snap_frame *) snapshot_take (cur, end, sizeof (snap_frame));
+  if (NULL is sf) return NOTOK;
+
+  /* the size of the grid can not overflow */
+  if (sf->grid_cols and
+      sf->grid_rows > (size_t) (end - *cur) / sf->grid_cols / (sizeof (int) * 2))
+    return NOTOK;
+
+  if (NULL is snapshot_take (cur, end, sf->argv_len) or
+      NULL is snapshot_take (cur, end, sf->cwd_len) or
+      NULL is snapshot_take (cur, end, sf->logfile_len) or
+      NULL is snapshot_take (cur, end, (size_t) sf->grid_rows * sf->grid_cols * sizeof (int) * 2) or
+      NULL is snapshot_take (cur, end, sf->log_len))
+    return NOTOK;
+
+  return OK;
+}
+
+static int snapshot_check (char *cur, char *end, uint32_t num_wins) {
+  for (uint32_t w = 0; w < num_wins; w++) {
+    snap_win *sw = (snap_win *) snapshot_take (&cur, end, sizeof (snap_win));
+    if (NULL is sw) return NOTOK;
+
+    char *name = snapshot_take (&cur, end, sw->name_len);
+    if (NULL is name or 0 is sw->name_len or name[sw->name_len - 1] isnot '\0')
+      return NOTOK;
+
+    if (sw->num_frames is 0 or sw->num_frames > sw->max_frames or
+        sw->num_frames > (size_t) (end - cur) / sizeof (snap_frame))
+      return NOTOK;
+
+    for (uint32_t f = 0; f < sw->num_frames; f++)
+      if (NOTOK is snapshot_check_frame (&cur, end))
+        return NOTOK;
+  }
+
+  return OK;
+}
+
+/* Appends the windows of a snapshot, with their screens as they were
+** saved.  The frames are forked when their window becomes current. */
+static int vwm_restore_snapshot (vwm_t *this, char *fname) {
+  int fd = open (fname, O_RDONLY|O_CLOEXEC);
+  if (-1 is fd) return NOTOK;
+
+  struct stat st;
+  if (-1 is fstat (fd, &st) or (size_t) st.st_size < sizeof (snap_header)) {
+    close (fd);
+    return NOTOK;
+  }
+
+  char *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map is MAP_FAILED) return NOTOK;
 
-static void vwm_release_win (vwm_t *this, vwm_win *win) {
-  int idx = self(get.win_idx, win);
-  if (idx is NOTOK) return;
+  int first_idx = $my(length);
 
-  vwm_win *w = self(pop_win_at, idx);
+  int retval = NOTOK;
+  char *cur = map;
+  char *end = map + st.st_size;
 
-  int len = w->length;
-  for (int i = 0; i < len; i++)
-    Vwin.release_frame_at (w, 0);
+  snap_header *hdr = (snap_header *) snapshot_take (&cur, end, sizeof (snap_header));
 
-  string_release (win->separators_buf);
-  string_release (win->render);
+  if (memcmp (hdr->magic, SNAPSHOT_MAGIC, sizeof (SNAPSHOT_MAGIC)) or
+      hdr->version isnot SNAPSHOT_VERSION or
+      hdr->byte_order isnot SNAPSHOT_BYTEORDER)
+    goto theend;
 
-  if ($my(last_win) is w and $my(length) isnot 0) {
-    if ($my(length) is 1)
-      $my(last_win) = $my(current);
-    else {
-      vwm_win *lw = $my(head);
-      while (lw) {
-        if (lw isnot $my(current)) {
-          $my(last_win) = lw;
-          break;
-        }
+  /* every frame restores its own cwd */
+  if (NULL is snapshot_take (&cur, end, hdr->cwd_len))
+    goto theend;
 
-        lw = lw->next;
-      }
-    }
-  }
+  if (NOTOK is snapshot_check (cur, end, hdr->num_wins))
+    goto theend;
 
-  free (w->name);
-  free (w);
-}
+  int same_size = (hdr->num_rows is (uint32_t) $my(num_rows) and
+                   hdr->num_cols is (uint32_t) $my(num_cols));
 
-static int vwm_spawn (vwm_t *this, char **argv) {
-  int status = NOTOK;
-  pid_t pid;
 
-  Vterm.orig_mode ($my(term));
+  for (uint32_t w = 0; w < hdr->num_wins; w++) {
+    snap_win *sw = (snap_win *) snapshot_take (&cur, end, sizeof (snap_win));
+    if (NULL is sw) goto theend;
 
-  if (-1 is (pid = fork ())) goto theend;
+    char *name = snapshot_take (&cur, end, sw->name_len);
+    if (NULL is name or 0 is sw->name_len or name[sw->name_len - 1] isnot '\0')
+      goto theend;
 
-  ifnot (pid) {
-    char lrows[4], lcols[4];
-    snprintf (lrows, 4, "%d", $my(num_rows));
-    snprintf (lcols, 4, "%d", $my(num_cols));
+    if (sw->num_frames is 0 or sw->num_frames > sw->max_frames or
+        sw->num_frames > (size_t) (end - cur) / sizeof (snap_frame))
+      goto theend;
 
-    setenv ("TERM", $my(term)->name, 1);
-    setenv ("LINES", lrows, 1);
-    setenv ("COLUMNS", lcols, 1);
+    vwm_win *win = self(new.win, name, WinOpts (
+        .num_rows = $my(num_rows),
+        .num_cols = $my(num_cols),
+        .num_frames = sw->num_frames,
+        .max_frames = sw->max_frames,
+        .lazy = 1));
 
-    execvp (argv[0], argv);
-    fprintf (stderr, "execvp failed\n");
-    _exit (1);
-  }
+    char *frames = cur;
+    vwm_frame *frame = win->head;
+    for (uint32_t f = 0; f < sw->num_frames; f++, frame = frame->next) {
+      snap_frame *sf = (snap_frame *) snapshot_take (&cur, end, sizeof (snap_frame));
+      if (NULL is sf) goto theend;
+
+      ifnot (sf->is_visible)
+        Vframe.set.visibility (frame, 0);
+
+      snapshot_take (&cur, end, sf->argv_len);
+      snapshot_take (&cur, end, sf->cwd_len);
+      snapshot_take (&cur, end, sf->logfile_len);
+      snapshot_take (&cur, end, (size_t) sf->grid_rows * sf->grid_cols * sizeof (int) * 2);
+      snapshot_take (&cur, end, sf->log_len);
+    }
 
-  if (-1 is waitpid (pid, &status, 0)) {
-    status = -1;
-    goto theend;
-  }
+    /* the geometry is laid out again, for the frames that are visible */
+    vwm_layout_win (this, win);
 
-  ifnot (WIFEXITED (status)) {
-    status = -1;
-    fprintf (stderr, "Failed to invoke %s\n", argv[0]);
-    goto theend;
+    cur = frames;
+    frame = win->head;
+    while (frame) {
+      if (NOTOK is snapshot_read_frame (this, frame, &cur, end, same_size))
+        goto theend;
+
+      frame = frame->next;
+    }
+
+    Vwin.set.current_at (win, sw->cur_frame_idx < sw->num_frames ? (int) sw->cur_frame_idx : 0);
+    win->is_restored = 1;
   }
 
-  ifnot (status is WEXITSTATUS (status))
-    fprintf (stderr, "Proc %s terminated with exit status: %d", argv[0], status);
+  if (hdr->num_wins)
+    self(set.current_at, first_idx + (hdr->cur_win_idx < hdr->num_wins ? (int) hdr->cur_win_idx : 0));
+
+  retval = OK;
 
 theend:
-  Vterm.raw_mode ($my(term));
-  return status;
+  /* nothing of a damaged snapshot is kept */
+  if (NOTOK is retval)
+    while ($my(length) > first_idx)
+      self(release_win, $my(tail));
+
+  munmap (map, st.st_size);
+  return retval;
 }
 
-static int frame_create_fd (vwm_frame *frame) {
-  if (frame->fd isnot -1) return frame->fd;
+/* Maps a recording, and returns the first record, or NULL if it is not one. */
+static char *recording_map (char *fname, vwm_rec_header *hdr, char **map, size_t *map_size) {
+  int fd = open (fname, O_RDONLY|O_CLOEXEC);
+  if (-1 is fd) return NULL;
 
-  int fd = -1;
-  if (-1 is (fd = posix_openpt (O_RDWR|O_NOCTTY|O_CLOEXEC))) goto theerror;
-  if (-1 is grantpt (fd)) goto theerror;
-  if (-1 is unlockpt (fd)) goto theerror;
-  char *name = ptsname (fd); ifnull (name) goto theerror;
-  cstring_cp (frame->tty_name, MAX_TTYNAME, name, MAX_TTYNAME - 1);
+  struct stat st;
+  if (-1 is fstat (fd, &st) or (size_t) st.st_size < sizeof (vwm_rec_header)) {
+    close (fd);
+    return NULL;
+  }
 
-  frame->fd = fd;
-  return fd;
+  *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (*map is MAP_FAILED) return NULL;
 
-theerror:
-  if (fd isnot -1)
-    close (fd);
+  *map_size = st.st_size;
+  memcpy (hdr, *map, sizeof (vwm_rec_header));
 
-  return -1;
+  if (memcmp (hdr->magic, VWM_REC_MAGIC, sizeof (VWM_REC_MAGIC)) or
+      hdr->version isnot VWM_REC_VERSION or
+      hdr->byte_order isnot VWM_REC_BYTEORDER) {
+    munmap (*map, *map_size);
+    return NULL;
+  }
+
+  return *map + sizeof (vwm_rec_header);
 }
 
-static pid_t frame_fork (vwm_frame *frame) {
-  if (frame->pid isnot -1)
-    return frame->pid;
+/* Returns the bytes of the record at *cur and steps over it, or NULL at
+** the end or at a record that was cut short. */
+static char *recording_next (char **cur, char *end, vwm_rec_record *r) {
+  if ((size_t) (end - *cur) < sizeof (vwm_rec_record)) return NULL;
 
-  char pid[8]; snprintf (pid, sizeof (pid), "%d", getpid ());
+  memcpy (r, *cur, sizeof (vwm_rec_record));
+  if ((size_t) (end - *cur) - sizeof (vwm_rec_record) < r->len) return NULL;
 
-  vwm_t *this = frame->parent->parent;
+  char *bytes = *cur + sizeof (vwm_rec_record);
+  *cur = bytes + r->len;
+  return bytes;
+}
 
-  signal (SIGWINCH, SIG_IGN);
+/* Plays a recording into the frame, at speed times the original pace, or
+** as fast as it goes when speed is 0, and at the size it was made at, but
+** not past the size of its window.  When the frame is in a window, a key
+** stops it, and then 1 is returned. */
+static int vwm_replay (vwm_t *this, vwm_frame *frame, char *fname, double speed) {
+  vwm_rec_header hdr;
+  char *map;
+  size_t map_size;
 
-  frame->pid = -1;
+  char *cur = recording_map (fname, &hdr, &map, &map_size);
+  if (NULL is cur) return NOTOK;
 
-  int fd = -1;
+  char *end = map + map_size;
+  ulong start = vwm_now_ns ();
+  int retval = OK;
 
-  if (frame->fd is -1) {
-    if (-1 is (fd = posix_openpt (O_RDWR|O_NOCTTY|O_CLOEXEC))) goto theerror;
-    if (-1 is grantpt (fd)) goto theerror;
-    if (-1 is unlockpt (fd)) goto theerror;
-    char *name = ptsname (fd); ifnull (name) goto theerror;
-    cstring_cp (frame->tty_name, MAX_TTYNAME, name, MAX_TTYNAME - 1);
-  } else
-    fd = frame->fd;
+  int max_rows = (frame->parent ? frame->num_rows : INT_MAX);
+  int max_cols = (frame->parent ? frame->num_cols : INT_MAX);
 
-  frame->fd = fd;
+  vwm_rec_record r;
+  char *bytes;
 
-  if (-1 is (frame->pid = fork ())) goto theerror;
+  while (NULL isnot (bytes = recording_next (&cur, end, &r))) {
+    if (r.num_rows and r.num_cols) {
+      int rows = (r.num_rows < max_rows ? r.num_rows : max_rows);
+      int cols = (r.num_cols < max_cols ? r.num_cols : max_cols);
 
-  ifnot (frame->pid) {
-    int slave_fd;
+      if (rows isnot frame->num_rows or cols isnot frame->num_cols)
+        Vframe.on_resize (frame, rows, cols);
+    }
 
-    setsid ();
+    if (speed > 0) {
+      ulong due = start + (ulong) (r.usec * 1000 / speed);
 
-    if (-1 is (slave_fd = open (frame->tty_name, O_RDWR|O_CLOEXEC|O_NOCTTY)))
-      goto theerror;
+      for (;;) {
+        ulong now = vwm_now_ns ();
+        if (now >= due) break;
 
-    ioctl (slave_fd, TIOCSCTTY, 0);
+        ulong wait = due - now;
 
-    dup2 (slave_fd, 0);
-    dup2 (slave_fd, 1);
-    dup2 (slave_fd, 2);
+        if (NULL is frame->parent) {
+          struct timespec ts = {.tv_sec = wait / 1000000000UL, .tv_nsec = wait % 1000000000UL};
+          nanosleep (&ts, NULL);
+          continue;
+        }
 
-    fd_set_size (slave_fd, frame->num_rows, frame->num_cols);
+        fd_set read_mask;
+        FD_ZERO (&read_mask);
+        FD_SET (STDIN_FILENO, &read_mask);
+        struct timeval tv = {.tv_sec = wait / 1000000000UL, .tv_usec = (wait % 1000000000UL) / 1000};
 
-    close (slave_fd);
-    close (fd);
+        if (0 < select (STDIN_FILENO + 1, &read_mask, NULL, NULL, &tv)) {
+          char c;
+          if (0 < read (STDIN_FILENO, &c, 1)) {
+            retval = 1;
+            goto theend;
+          }
+        }
+      }
+    }
 
-    int maxfd;
-#ifdef OPEN_MAX
-    maxfd = OPEN_MAX;
-#else
-    maxfd = sysconf (_SC_OPEN_MAX);
-#endif
+    frame->process_output_cb (frame, bytes, r.len);
+  }
 
-    for (int fda = 3; fda < maxfd; fda++)
-      if (close (fda) is -1 and errno is EBADF)
-        break;
+theend:
+  munmap (map, map_size);
+  return retval;
+}
 
-    sigset_t emptyset;
-    sigemptyset (&emptyset);
-    sigprocmask (SIG_SETMASK, &emptyset, NULL);
+static void asciicast_put_string (FILE *fp, string_t *carry, char *bytes, size_t len) {
+  string_append_with_len (carry, bytes, len);
 
-    char rows[4]; snprintf (rows, 4, "%d", frame->num_rows);
-    char cols[4]; snprintf (cols, 4, "%d", frame->num_cols);
-    setenv ("TERM",  $my(term)->name, 1);
-    setenv ("LINES", rows, 1);
-    setenv ("COLUMNS", cols, 1);
-    setenv ("VWM", pid, 1);
+  uchar *s = (uchar *) carry->bytes;
+  size_t n = carry->num_bytes;
+  size_t i = 0;
 
-    frame->pid = getpid ();
+  fputc ('"', fp);
 
-    int retval = frame->at_fork_cb (frame, this, frame->parent);
+  while (i < n) {
+    uchar c = s[i];
 
-    if (retval is NOTOK)
-      goto theerror;
+    if (c < 0x80) {
+      if (c is '"' or c is '\\')
+        fprintf (fp, "\\%c", c);
+      else if (c < ' ' or c is 0x7f)
+        fprintf (fp, "\\u%04x", c);
+      else
+        fputc (c, fp);
 
-    ifnot (retval)
-      return 0;
+      i++;
+      continue;
+    }
 
-    if (retval is 1) {
-      execvp (frame->argv[0], frame->argv);
+    int clen = (c & 0xE0) is 0xC0 ? 2 : (c & 0xF0) is 0xE0 ? 3 : (c & 0xF8) is 0xF0 ? 4 : 0;
 
-      fprintf (stderr, "execvp() failed for command: '%s'\n", frame->argv[0]);
-      _exit (1);
+    /* the rest of the character comes with the next record */
+    if (clen and i + clen > n) {
+      int valid = 1;
+      for (size_t j = i + 1; j < n; j++)
+        if ((s[j] & 0xC0) isnot 0x80) valid = 0;
+
+      if (valid) break;
     }
-  }
 
-  goto theend;
+    int valid = (clen isnot 0 and i + clen <= n);
+    for (int j = 1; valid and j < clen; j++)
+      if ((s[i + j] & 0xC0) isnot 0x80) valid = 0;
 
-theerror:
-  ifnot (-1 is frame->pid) {
-    kill (frame->pid, SIGHUP);
-    waitpid (frame->pid, NULL, 0);
+    if (valid) {
+      fwrite (s + i, 1, clen, fp);
+      i += clen;
+    } else {
+      fprintf (fp, "\\ufffd");
+      i++;
+    }
   }
 
-  frame->pid = -1;
-  frame->fd = -1;
-
-  ifnot (-1 is fd) close (fd);
+  fputc ('"', fp);
 
-theend:
-  signal (SIGWINCH, vwm_sigwinch_handler);
-  return frame->pid;
+  string_clear (carry);
+  if (i < n)
+    string_append_with_len (carry, (char *) s + i, n - i);
 }
 
-static void vwm_sigwinch_handler (int sig) {
-  signal (sig, vwm_sigwinch_handler);
-  vwm_t *this = VWM;
-  $my(need_resize) = 1;
-}
+/* Writes a recording as an asciicast v2 file, as the one that asciinema
+** plays; a record with a new size becomes a resize event. */
+static int vwm_export_asciicast (vwm_t *this, char *rec_fname, char *cast_fname) {
+  (void) this;
 
-static void vwm_handle_sigwinch (vwm_t *this) {
-  int rows; int cols;
-  Vterm.init_size ($my(term), &rows, &cols);
-  self(set.size, rows, cols, 1);
+  vwm_rec_header hdr;
+  char *map;
+  size_t map_size;
 
-  vwm_win *win = $my(head);
-  while (win) {
-    win->num_rows = $my(num_rows);
-    win->num_cols = $my(num_cols);
-    win->last_row = win->num_rows;
+  char *cur = recording_map (rec_fname, &hdr, &map, &map_size);
+  if (NULL is cur) return NOTOK;
 
-    int frame_rows = 0;
-    int num_frames = Vwin.get.num_visible_frames (win);
-    int mod = Vwin.frame_rows (win, num_frames, &frame_rows);
+  FILE *fp = fopen (cast_fname, "w");
+  if (NULL is fp) {
+    munmap (map, map_size);
+    return NOTOK;
+  }
 
-    int
-      num_rows = frame_rows + mod,
-      first_row = win->first_row;
+  fprintf (fp, "{\"version\": 2, \"width\": %u, \"height\": %u, \"timestamp\": %lu}\n",
+      hdr.num_cols, hdr.num_rows, hdr.timestamp);
 
-    vwm_frame *frame = win->head;
-    while (frame) {
-      Vframe.on_resize (frame, num_rows, win->num_cols);
+  char *end = map + map_size;
+  unsigned int rows = hdr.num_rows;
+  unsigned int cols = hdr.num_cols;
+  string_t *carry = string_new (8);
 
-      frame->first_row = first_row;
-      frame->num_rows = num_rows;
-      frame->last_row = frame->num_rows;
+  vwm_rec_record r;
+  r.usec = 0;
+  char *bytes;
 
-      if (frame->argv and frame->pid isnot -1) {
-        struct winsize ws = {.ws_row = frame->num_rows, .ws_col = frame->num_cols};
-        ioctl (frame->fd, TIOCSWINSZ, &ws);
-        kill (frame->pid, SIGWINCH);
-      }
+  while (NULL isnot (bytes = recording_next (&cur, end, &r))) {
+    if (r.num_rows isnot rows or r.num_cols isnot cols) {
+      rows = r.num_rows;
+      cols = r.num_cols;
+      fprintf (fp, "[%lu.%06lu, \"r\", \"%ux%u\"]\n", r.usec / 1000000, r.usec % 1000000, cols, rows);
+    }
 
-      if (frame->is_visible) {
-        first_row += num_rows + 1;
-        num_rows = frame_rows;
-      }
+    fprintf (fp, "[%lu.%06lu, \"o\", ", r.usec / 1000000, r.usec % 1000000);
+    asciicast_put_string (fp, carry, bytes, r.len);
+    fprintf (fp, "]\n");
+  }
 
-      frame = frame->next;
-    }
-    win = win->next;
+  /* a character that the recording ends in the middle of */
+  if (carry->num_bytes) {
+    fprintf (fp, "[%lu.%06lu, \"o\", \"", r.usec / 1000000, r.usec % 1000000);
+    for (size_t i = 0; i < carry->num_bytes; i++)
+      fprintf (fp, "\\ufffd");
+    fprintf (fp, "\"]\n");
   }
 
-  win = $my(current);
+  string_free (carry);
+  munmap (map, map_size);
 
-  Vwin.draw (win);
-  $my(need_resize) = 0;
+  return (fclose (fp) ? NOTOK : OK);
+}
+
+static volatile sig_atomic_t seq_need_save = 0;
+
+static void vwm_sequences_signal (int sig) {
+  signal (sig, vwm_sequences_signal);
+  seq_need_save = 1;
 }
 
 static void vwm_exit_signal (int sig) {
@@ -4332,9 +6632,14 @@ static int vwm_main (vwm_t *this) {
   signal (SIGSEGV,  vwm_exit_signal);
   signal (SIGBUS,   vwm_exit_signal);
   signal (SIGWINCH, vwm_sigwinch_handler);
+  signal (SIGCHLD,  vwm_sigchld_handler);
+  signal (SIGUSR1,  vwm_sequences_signal);
+#ifdef VWM_TRACE
+  signal (SIGUSR2,  vwm_trace_signal);
+#endif
 
   fd_set read_mask;
-  struct timeval *tv = NULL;
+  struct timeval tv_buf, *tv = NULL;
 
   char
     input_buf[MAX_CHAR_LEN],
@@ -4346,22 +6651,21 @@ static int vwm_main (vwm_t *this) {
     output_len,
     retval = NOTOK;
 
-  vwm_win *win = $my(current);
-
-  Vwin.set.separators (win, DRAW);
-
-  vwm_frame *frame = win->head;
-  while (frame) {
-    if (frame->argv is NULL)
-      Vframe.set.command (frame, $my(default_app)->bytes);
+  vwm_win
+    *win = $my(current),
+    *reaped_win = NULL;
 
-    Vframe.fork (frame);
+  vwm_fork_frames (this, win);
 
-    frame = frame->next;
-  }
+  if (win->is_restored)
+    Vwin.draw (win);
+  else
+    Vwin.set.separators (win, DRAW);
 
   win->is_initialized = 1;
 
+  vwm_frame *frame;
+
 #define forever for (;;)
 
   forever {
@@ -4371,6 +6675,18 @@ static int vwm_main (vwm_t *this) {
       break;
     }
 
+    if (seq_need_save) {
+      seq_need_save = 0;
+      self(save_sequences, NULL);
+    }
+
+#ifdef VWM_TRACE
+    if (trace_need_dump) {
+      trace_need_dump = 0;
+      vwm_trace_dump (this, NULL);
+    }
+#endif
+
     check_length:
 
     ifnot (Vwin.get.num_visible_frames (win)) { // at_no_length_cb
@@ -4382,23 +6698,50 @@ static int vwm_main (vwm_t *this) {
       continue;
     }
 
-    if ($my(need_resize))
-      vwm_handle_sigwinch (this);
+    long wait_ms = vwm_check_resize (this);
+    if (-1 is wait_ms)
+      tv = NULL;
+    else {
+      tv_buf.tv_sec = wait_ms / 1000;
+      tv_buf.tv_usec = (wait_ms % 1000) * 1000;
+      tv = &tv_buf;
+    }
 
     Vwin.set.frame (win, win->current);
 
-    maxfd = 1;
+    /* After a frame took one, while there is nothing else to do. */
+    if ($my(pool_len) < $my(pool_size))
+      vwm_pool_fill (this);
+
+    /* The children are waited for only after a SIGCHLD, or when the
+    ** window changes, as exits in other windows are not handled. */
+    int reap = ($my(need_reap) or win isnot reaped_win);
+    $my(need_reap) = 0;
+    reaped_win = win;
+
+    maxfd = $my(sigchld_fd)[0] + 1;
 
     FD_ZERO (&read_mask);
     FD_SET (STDIN_FILENO, &read_mask);
+    FD_SET ($my(sigchld_fd)[0], &read_mask);
+
+    if ($my(extern_fd) isnot -1) {
+      FD_SET ($my(extern_fd), &read_mask);
+      if (maxfd <= $my(extern_fd))
+        maxfd = $my(extern_fd) + 1;
+    }
 
     frame = win->head;
     int num_frames = 0;
     while (frame) {
       ifnot (frame->is_visible) goto frame_next;
 
-      if (frame->pid isnot -1) {
-        if (0 is Vframe.check_pid (frame)) {
+      if (reap and frame->pid isnot -1) {
+        VWM_TRACE_BEGIN ("waitpid");
+        int running = Vframe.check_pid (frame);
+        VWM_TRACE_END ("waitpid");
+
+        if (0 is running) {
           vwm_frame *tmp = frame->next;
           Vwin.delete_frame (win, frame, DRAW);
           frame = tmp;
@@ -4420,7 +6763,14 @@ frame_next:
 
     ifnot (num_frames) goto check_length;
 
-    if (0 >= (numready = select (maxfd, &read_mask, NULL, NULL, tv))) {
+    VWM_TRACE_BEGIN ("select");
+    ulong t = vwm_now_ns ();
+    numready = select (maxfd, &read_mask, NULL, NULL, tv);
+    $my(counters).select_ns += vwm_now_ns () - t;
+    VWM_TRACE_END ("select");
+    $my(counters).num_wakeups++;
+
+    if (0 >= numready) {
       switch (errno) {
         case EIO:
         case EINTR:
@@ -4433,11 +6783,29 @@ frame_next:
 
     frame = win->current;
 
+    if (FD_ISSET ($my(sigchld_fd)[0], &read_mask))
+      vwm_handle_sigchld (this);
+
+    if ($my(extern_fd) isnot -1 and FD_ISSET ($my(extern_fd), &read_mask)) {
+      $my(extern_fd_cb) (this, $my(extern_fd));
+
+      /* the window might have changed or gone */
+      if (NULL is (win = $my(current)))
+        continue;
+
+      frame = win->current;
+    }
+
     for (int i = 0; i < MAX_CHAR_LEN; i++) input_buf[i] = '\0';
 
     if (FD_ISSET (STDIN_FILENO, &read_mask)) {
       if (0 < fd_read (STDIN_FILENO, input_buf, 1)) {
-        if (VWM_QUIT is self(process_input, win, frame, input_buf)) {
+        $my(counters).stdin_bytes++;
+        VWM_TRACE_BEGIN ("input");
+        int state = self(process_input, win, frame, input_buf);
+        VWM_TRACE_END ("input");
+
+        if (VWM_QUIT is state) {
           retval = OK;
           break;
         }
@@ -4453,7 +6821,11 @@ frame_next:
 
       if (FD_ISSET (frame->fd, &read_mask)) {
         output_buf[0] = '\0';
-        if (0 > (output_len = read (frame->fd, output_buf, BUFSIZE))) {
+        VWM_TRACE_BEGIN ("read");
+        output_len = read (frame->fd, output_buf, BUFSIZE);
+        VWM_TRACE_END ("read");
+
+        if (0 > output_len) {
           switch (errno) {
             case EIO:
             default:
@@ -4725,11 +7097,21 @@ public vwm_t *__init_vwm__ (void) {
     .self = (vwm_self) {
       .main = vwm_main,
       .spawn = vwm_spawn,
+      .save_snapshot = vwm_save_snapshot,
+      .restore_snapshot = vwm_restore_snapshot,
+      .trace_dump = vwm_trace_dump,
+      .save_sequences = vwm_save_sequences,
+      .export_asciicast = vwm_export_asciicast,
+      .replay = vwm_replay,
+      .resize = vwm_resize,
+      .queue_resize = vwm_queue_resize,
+      .handle_sigchld = vwm_handle_sigchld,
       .getkey = vwm_getkey,
       .pop_win_at = vwm_pop_win_at,
       .change_win = vwm_change_win,
       .append_win = vwm_append_win,
       .release_win = vwm_release_win,
+      .release_frame = vwm_release_frame,
       .release_info = vwm_release_info,
       .process_input = vwm_process_input,
       .get = (vwm_get_self) {
@@ -4748,6 +7130,7 @@ public vwm_t *__init_vwm__ (void) {
         .mode_key = vwm_get_mode_key,
         .current_win = vwm_get_current_win,
         .default_app = vwm_get_default_app,
+        .sigchld_fd = vwm_get_sigchld_fd,
         .current_frame = vwm_get_current_frame,
         .current_win_idx = vwm_get_current_win_idx
       },
@@ -4762,10 +7145,14 @@ public vwm_t *__init_vwm__ (void) {
         .object = vwm_set_object,
         .current_at = vwm_set_current_at,
         .default_app = vwm_set_default_app,
+        .pool = vwm_set_pool,
         .rline_cb = vwm_set_rline_cb,
         .on_tab_cb = vwm_set_on_tab_cb,
         .at_exit_cb = vwm_set_at_exit_cb,
+        .trace = vwm_set_trace,
         .edit_file_cb = vwm_set_edit_file_cb,
+        .output_cb = vwm_set_output_cb,
+        .extern_fd = vwm_set_extern_fd,
         .process_input_cb = vwm_set_process_input_cb,
         .debug = (vwm_set_debug_self) {
           .sequences = vwm_set_debug_sequences,
@@ -4781,6 +7168,7 @@ public vwm_t *__init_vwm__ (void) {
       },
       .new = (vwm_new_self) {
         .win = vwm_new_win,
+        .frame = vwm_new_frame,
         .term = vwm_new_term
       }
     },
@@ -4844,6 +7232,7 @@ public vwm_t *__init_vwm__ (void) {
       .kill_proc = frame_kill_proc,
       .reopen_log = frame_reopen_log,
       .release_log = frame_release_log,
+      .release_record = frame_release_record,
       .release_argv = frame_release_argv,
       .release_info = frame_release_info,
       .process_output = frame_process_output,
@@ -4857,7 +7246,13 @@ public vwm_t *__init_vwm__ (void) {
         .logfd = frame_get_logfd,
         .parent = frame_get_parent,
         .logfile = frame_get_logfile,
+        .cell = frame_get_cell,
+        .line = frame_get_line,
+        .row_pos = frame_get_row_pos,
+        .col_pos = frame_get_col_pos,
         .num_rows = frame_get_num_rows,
+        .num_cols = frame_get_num_cols,
+        .textattr = frame_get_textattr,
         .remove_log = frame_get_remove_log,
         .visibility = frame_get_visibility
       },
@@ -4867,8 +7262,10 @@ public vwm_t *__init_vwm__ (void) {
         .argv = frame_set_argv,
         .command = frame_set_command,
         .visibility = frame_set_visibility,
+        .output_cb = frame_set_output_cb,
         .at_fork_cb = frame_set_at_fork_cb,
         .unimplemented_cb = frame_set_unimplemented_cb,
+        .record = frame_set_record,
         .process_output_cb = frame_set_process_output_cb
       }
     },
@@ -4889,6 +7286,18 @@ public vwm_t *__init_vwm__ (void) {
   $my(num_at_exit_cbs) = 0;
   $my(process_input_cbs) = 0;
   $my(objects)[VWMED_OBJECT] = NULL;
+  $my(output_cb) = NULL;
+  $my(extern_fd) = -1;
+
+  if (-1 is pipe ($my(sigchld_fd))) {
+    fprintf (stderr, "pipe: %s\n", strerror (errno));
+    exit (1);
+  }
+
+  for (int i = 0; i < 2; i++) {
+    fcntl ($my(sigchld_fd)[i], F_SETFD, FD_CLOEXEC);
+    fcntl ($my(sigchld_fd)[i], F_SETFL, O_NONBLOCK);
+  }
 
   self(new.term);
 
@@ -4897,7 +7306,7 @@ public vwm_t *__init_vwm__ (void) {
   self(set.edit_file_cb, vwm_default_edit_file_cb);
   self(set.tmpdir, NULL, 0);
 
-  $my(sequences_fp) = NULL;
+  $my(sequences) = NULL;
   $my(sequences_fname) = NULL;
   $my(unimplemented_fp) = NULL;
   $my(unimplemented_fname) = NULL;
@@ -4905,6 +7314,15 @@ public vwm_t *__init_vwm__ (void) {
 #ifdef DEBUG
   self(set.debug.sequences, NULL);
   self(set.debug.unimplemented, NULL);
+#else
+  char *sequences = getenv ("VWM_SEQUENCES");
+  ifnot (NULL is sequences)
+    self(set.debug.sequences, (sequences[0] ? sequences : NULL));
+#endif
+
+#ifdef VWM_TRACE
+  if (NULL isnot getenv ("VWM_TRACE"))
+    self(set.trace, 1);
 #endif
 
   VWM = this;
@@ -4943,6 +7361,13 @@ public void __deinit_vwm__ (vwm_t **thisp) {
   string_release ($my(shell));
   string_release ($my(default_app));
 
+  close ($my(sigchld_fd)[0]);
+  close ($my(sigchld_fd)[1]);
+
+  vwm_pool_release (this, 0);
+
+  free ($my(reflow_buf));
+  render_arena_release (&$my(renders));
   free (this->prop);
   free (this);
   *thisp = NULL;
@@ -69,6 +69,8 @@ typedef signed int utf8;
 
 #define VFRAME_CLEAR_VIDEO_MEM   (1 << 0)
 #define VFRAME_CLEAR_LOG         (1 << 1)
+
+#define VWM_SNAPSHOT_LOG         (1 << 0)
 #define VFRAME_ESC_PROCESS_DIGIT (1 << 2)
 
 #ifndef DRAW
@@ -137,7 +139,24 @@ typedef struct vwm_win vwm_win;
 typedef struct vwm_frame vwm_frame;
 typedef struct vwm_t vwm_t;
 
+#ifdef VWM_TRACE
+/* when compiled with -DVWM_TRACE, the main loops record begin (B) and end (E)
+ * events, while vwm_trace_enabled is set, see Vwm.set.trace and Vwm.trace_dump */
+public extern int vwm_trace_enabled;
+public void vwm_trace_event (const char *, int);
+
+#define VWM_TRACE_BEGIN(__name__) \
+  do { if (vwm_trace_enabled) vwm_trace_event ((__name__), 'B'); } while (0)
+
+#define VWM_TRACE_END(__name__) \
+  do { if (vwm_trace_enabled) vwm_trace_event ((__name__), 'E'); } while (0)
+#else
+#define VWM_TRACE_BEGIN(__name__) do {} while (0)
+#define VWM_TRACE_END(__name__)   do {} while (0)
+#endif
+
 typedef void (*FrameProcessOutput_cb) (vwm_frame *, char *, int);
+typedef void (*FrameOutput_cb) (vwm_frame *, char *, size_t);
 typedef void (*FrameUnimplemented_cb) (vwm_frame *, const char *, int, int);
 typedef void (*VwmAtExit_cb) (vwm_t *);
 typedef int  (*VwmOnTab_cb) (vwm_t *, vwm_win *, vwm_frame *, void *);
@@ -145,6 +164,8 @@ typedef int  (*VwmRLine_cb) (vwm_t *, vwm_win *, vwm_frame *, void *);
 typedef int  (*VwmEditFile_cb) (vwm_t *, vwm_frame *, char *, void *);
 typedef int  (*FrameAtFork_cb) (vwm_frame *, vwm_t *, vwm_win *);
 typedef int  (*ProcessInput_cb) (vwm_t *, vwm_win *, vwm_frame *, utf8);
+typedef void (*VwmOutput_cb) (vwm_t *, char *, size_t);
+typedef void (*VwmExternFd_cb) (vwm_t *, int);
 
 struct vwm_term {
   struct termios
@@ -160,6 +181,9 @@ struct vwm_term {
     columns,
     out_fd,
     in_fd;
+
+  /* its escapes go where the render of root goes */
+  vwm_t *root;
 };
 
 typedef struct frame_opts {
@@ -180,7 +204,8 @@ typedef struct frame_opts {
     create_fd,
     enable_log,
     remove_log,
-    is_visible;
+    is_visible,
+    lazy;
 
   pid_t pid;
 
@@ -207,6 +232,7 @@ typedef struct frame_opts {
   .enable_log = 0,                    \
   .remove_log = 1,                    \
   .is_visible = 1,                    \
+  .lazy = 0,                          \
   .process_output_cb = NULL,          \
   .at_fork_cb = NULL,                 \
   .parent = NULL,                     \
@@ -221,7 +247,8 @@ typedef struct win_opts {
     first_row,
     first_col,
     num_frames,
-    max_frames;
+    max_frames,
+    lazy;
 
   frame_opts frame_opts[WIN_OPTS_MAX_FRAMES];
 } win_opts;
@@ -234,6 +261,7 @@ typedef struct win_opts {
   .first_col = 1,                  \
   .num_frames = 1,                 \
   .max_frames = 3,                 \
+  .lazy = 0,                       \
   .draw = DONOT_DRAW,              \
   .frame_opts[0] = FrameOpts(),    \
   .frame_opts[1] = FrameOpts(),    \
@@ -243,6 +271,114 @@ typedef struct win_opts {
   .frame_opts[5] = FrameOpts(),    \
   __VA_ARGS__ }
 
+/* cheap and always on; the times are in nanoseconds */
+typedef struct vframe_counters {
+  ulong
+    num_reads,
+    bytes_read,
+    bytes_rendered,
+    num_ctrl,           /* C0 controls */
+    num_esc,            /* escape sequences, other than CSI */
+    num_csi,            /* CSI sequences, SGR included */
+    num_sgr,
+    scrolled_lines,
+    num_redraws,        /* the times the frame was drawn in whole */
+    parse_ns,
+    write_ns;
+} vframe_counters;
+
+typedef struct vwin_counters {
+  ulong
+    num_draws,
+    num_cached_draws;
+} vwin_counters;
+
+typedef struct vwm_counters {
+  ulong
+    num_wakeups,
+    select_ns,
+    stdin_bytes;
+} vwm_counters;
+
+/* The sequence trace, see Vwm.set.debug.sequences.  A saved trace is a
+ * vwm_seq_header and then num_records records, the oldest first; each is
+ * a vwm_seq_record, followed by the len bytes that the frame read. */
+#define VWM_SEQ_MAGIC     "VWMSEQS"
+#define VWM_SEQ_VERSION   1
+#define VWM_SEQ_BYTEORDER 0x01020304
+
+/* the state of the parser, before the first byte of a record */
+enum vwm_seq_parser {
+  VWM_SEQ_TEXT,
+  VWM_SEQ_ESC,
+  VWM_SEQ_CSI,
+  VWM_SEQ_CSI_PRIVATE,
+  VWM_SEQ_G0_CHARSET,
+  VWM_SEQ_G1_CHARSET,
+  VWM_SEQ_POUND
+};
+
+typedef struct vwm_seq_header {
+  char magic[8];
+
+  unsigned int
+    version,
+    byte_order,
+    num_records,
+    num_dropped;        /* the oldest records, that were overwritten */
+} vwm_seq_header;
+
+typedef struct vwm_seq_record {
+  ulong ts_ns;          /* CLOCK_MONOTONIC */
+
+  unsigned int
+    len,
+    frame_id;
+
+  int
+    row_pos,
+    col_pos;
+
+  unsigned short
+    num_rows,
+    num_cols;
+
+  uchar
+    parser,
+    textattr,
+    param_idx,
+    mb_len;
+} vwm_seq_record;
+
+/* A recording, see Vframe.set.record.  It is a vwm_rec_header and then the
+ * records as they were appended; each is a vwm_rec_record, followed by the
+ * len bytes of the output.  A record that was cut short ends the recording. */
+#define VWM_REC_MAGIC     "VWMREC"
+#define VWM_REC_VERSION   1
+#define VWM_REC_BYTEORDER 0x01020304
+
+typedef struct vwm_rec_header {
+  char magic[8];
+
+  unsigned int
+    version,
+    byte_order,
+    num_rows,
+    num_cols;
+
+  ulong timestamp;      /* seconds since the epoch, at the start */
+} vwm_rec_header;
+
+typedef struct vwm_rec_record {
+  ulong usec;           /* since the start */
+
+  unsigned int len;
+
+  unsigned short
+    num_rows,
+    num_cols;
+} vwm_rec_record;
+
 typedef struct vframe_info {
   char *logfile;
 
@@ -256,6 +392,8 @@ typedef struct vframe_info {
 
   pid_t pid;
 
+  vframe_counters counters;
+
   char *argv[MAX_ARGS];
 } vframe_info;
 
@@ -270,6 +408,8 @@ typedef struct vwin_info {
     cur_frame_idx,
     num_visible_frames;
 
+  vwin_counters counters;
+
   vframe_info **frames;
 } vwin_info;
 
@@ -283,6 +423,9 @@ typedef struct vwm_info {
     cur_win_idx;
 
   pid_t pid;
+
+  vwm_counters counters;
+
   vwin_info **wins;
 } vwm_info;
 
@@ -316,9 +459,15 @@ typedef struct vwm_frame_get_self {
     (*fd)  (vwm_frame *),
     (*argc) (vwm_frame *),
     (*logfd) (vwm_frame *),
+    (*row_pos) (vwm_frame *),
+    (*col_pos) (vwm_frame *),
     (*num_rows) (vwm_frame *),
+    (*num_cols) (vwm_frame *),
+    (*textattr) (vwm_frame *),
     (*remove_log) (vwm_frame *),
-    (*visibility) (vwm_frame *);
+    (*visibility) (vwm_frame *),
+    (*cell) (vwm_frame *, int, int, int *),
+    (*line) (vwm_frame *, int, char *, size_t);
 
   pid_t (*pid) (vwm_frame *);
 
@@ -334,9 +483,12 @@ typedef struct vwm_frame_set_self {
     (*argv) (vwm_frame *, int, char **),
     (*command) (vwm_frame *, char *),
     (*visibility) (vwm_frame *, int),
+    (*output_cb) (vwm_frame *, FrameOutput_cb),
     (*unimplemented_cb) (vwm_frame *, FrameUnimplemented_cb);
 
-  int (*log) (vwm_frame *, char *,  int);
+  int
+    (*log) (vwm_frame *, char *,  int),
+    (*record) (vwm_frame *, char *);
 
   FrameProcessOutput_cb (*process_output_cb) (vwm_frame *, FrameProcessOutput_cb);
   FrameAtFork_cb (*at_fork_cb) (vwm_frame *, FrameAtFork_cb);
@@ -354,6 +506,7 @@ typedef struct vwm_frame_self {
     (*reopen_log) (vwm_frame *),
     (*release_log) (vwm_frame *),
     (*release_info) (vframe_info *),
+    (*release_record) (vwm_frame *),
     (*release_argv) (vwm_frame *),
     (*process_output) (vwm_frame *, char *, int);
 
@@ -438,6 +591,7 @@ typedef struct vwm_get_self {
     (*columns) (vwm_t *),
     (*win_idx) (vwm_t *, vwm_win *),
     (*num_wins) (vwm_t *),
+    (*sigchld_fd) (vwm_t *),
     (*current_win_idx) (vwm_t *);
 
   char
@@ -480,6 +634,7 @@ typedef struct vwm_set_self {
     (*size)   (vwm_t *, int, int, int),
     (*term)   (vwm_t *, vwm_term *),
     (*state)  (vwm_t *, int),
+    (*pool)   (vwm_t *, int),
     (*shell)  (vwm_t *, char *),
     (*editor) (vwm_t *, char *),
     (*object) (vwm_t *, void *, int),
@@ -487,8 +642,11 @@ typedef struct vwm_set_self {
     (*rline_cb) (vwm_t *, VwmRLine_cb),
     (*on_tab_cb) (vwm_t *, VwmOnTab_cb),
     (*at_exit_cb) (vwm_t *, VwmAtExit_cb),
+    (*trace) (vwm_t *, int),
     (*default_app) (vwm_t *, char *),
     (*edit_file_cb) (vwm_t *, VwmEditFile_cb),
+    (*output_cb) (vwm_t *, VwmOutput_cb),
+    (*extern_fd) (vwm_t *, int, VwmExternFd_cb),
     (*process_input_cb) (vwm_t *, ProcessInput_cb);
 
   int (*tmpdir) (vwm_t *, char *, size_t);
@@ -499,6 +657,7 @@ typedef struct vwm_set_self {
 
 typedef struct vwm_new_self {
   vwm_win *(*win) (vwm_t *, char *, win_opts);
+  vwm_frame *(*frame) (vwm_t *, frame_opts);
   vwm_term *(*term) (vwm_t *);
 } vwm_new_self;
 
@@ -509,13 +668,23 @@ typedef struct vwm_self {
    vwm_unset_self unset;
 
   void
+    (*resize) (vwm_t *, int, int),
+    (*handle_sigchld) (vwm_t *),
     (*change_win) (vwm_t *, vwm_win *, int, int),
     (*release_win) (vwm_t *, vwm_win *),
+    (*release_frame) (vwm_t *, vwm_frame *),
     (*release_info) (vwm_t *, vwm_info **);
 
   int
     (*main) (vwm_t *),
     (*spawn) (vwm_t *, char **),
+    (*save_snapshot) (vwm_t *, char *, int),
+    (*restore_snapshot) (vwm_t *, char *),
+    (*trace_dump) (vwm_t *, char *),
+    (*save_sequences) (vwm_t *, char *),
+    (*export_asciicast) (vwm_t *, char *, char *),
+    (*replay) (vwm_t *, vwm_frame *, char *, double),
+    (*queue_resize) (vwm_t *, int, int),
     (*append_win) (vwm_t *, vwm_win *),
     (*process_input) (vwm_t *, vwm_win *, vwm_frame *, char *);
 
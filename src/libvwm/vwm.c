@@ -1,10 +1,23 @@
 /* An application that utilises the library, that might be useful
  * as a tiny window manager, though it is meant for demonstration.
+ *
+ * Options, that come before the command of the first frame:
+ *   --record=file     records the output of the first frame
+ *   --replay=file     plays a recording in a frame, instead
+ *   --speed=n         with --replay, n times the original pace; 0 is as
+ *                     fast as it goes, and prints the rate at the end
+ *   --asciicast=file  with --replay, writes the recording as asciicast v2
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/termios.h>
 
 #include <libv/libvwm.h>
@@ -14,9 +27,95 @@
 #define Vwin   this->win
 #define Vterm  this->term
 
+static int replay (vwm_t *this, vwm_term *term, int rows, int cols, char *fname, double speed) {
+  struct stat st;
+  if (-1 == stat (fname, &st)) {
+    fprintf (stderr, "%s: can not be read\n", fname);
+    return 1;
+  }
+
+  vwm_win *win = Vwm.new.win (this, "replay", WinOpts (
+    .num_rows = rows,
+    .num_cols = cols,
+    .num_frames = 1,
+    .max_frames = 1));
+
+  vwm_frame *frame = Vwin.get.frame_at (win, 0);
+
+  Vterm.screen.save (term);
+  Vterm.screen.clear (term);
+  Vwin.draw (win);
+
+  struct timespec t0, t1;
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+
+  int retval = Vwm.replay (this, frame, fname, speed);
+
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+
+  /* the last screen stays until a key, unless one has stopped the replay */
+  if (0 != speed && 0 == retval) {
+    char c;
+    if (-1 == read (STDIN_FILENO, &c, 1)) {}
+  }
+
+  Vterm.screen.restore (term);
+
+  if (-1 == retval) {
+    fprintf (stderr, "%s: is not a recording\n", fname);
+    return 1;
+  }
+
+  if (0 == speed) {
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf (stderr, "%s: %ld bytes in %.3f seconds, %.2f MB/s\n", fname,
+        (long) st.st_size, secs, st.st_size / (1024.0 * 1024.0) / secs);
+  }
+
+  return 0;
+}
+
 int main (int argc, char **argv) {
+  char
+    *record = NULL,
+    *replay_fname = NULL,
+    *asciicast = NULL;
+
+  double speed = 1;
+
+  int i = 1;
+  for (; i < argc; i++) {
+    if (0 == strncmp (argv[i], "--record=", 9))
+      record = argv[i] + 9;
+    else if (0 == strncmp (argv[i], "--replay=", 9))
+      replay_fname = argv[i] + 9;
+    else if (0 == strncmp (argv[i], "--speed=", 8))
+      speed = atof (argv[i] + 8);
+    else if (0 == strncmp (argv[i], "--asciicast=", 12))
+      asciicast = argv[i] + 12;
+    else
+      break;
+  }
+
+  argc -= i - 1;
+  argv += i - 1;
+
   vwm_t *this = __init_vwm__ ();
 
+  if (NULL != asciicast) {
+    int retval = 1;
+
+    if (NULL == replay_fname)
+      fprintf (stderr, "--asciicast needs --replay\n");
+    else if (-1 == Vwm.export_asciicast (this, replay_fname, asciicast))
+      fprintf (stderr, "%s: can not be written as %s\n", replay_fname, asciicast);
+    else
+      retval = 0;
+
+    __deinit_vwm__ (&this);
+    return retval;
+  }
+
   vwm_term *term =  Vwm.get.term (this);
 
   Vterm.raw_mode (term);
@@ -26,6 +125,12 @@ int main (int argc, char **argv) {
 
   Vwm.set.size (this, rows, cols, 1);
 
+  if (NULL != replay_fname) {
+    int retval = replay (this, term, rows, cols, replay_fname, speed);
+    __deinit_vwm__ (&this);
+    return retval;
+  }
+
   vwm_win *win = Vwm.new.win (this, "v", WinOpts (
     .num_rows = rows,
     .num_cols = cols,
@@ -38,6 +143,12 @@ int main (int argc, char **argv) {
 
   Vframe.set.log (frame, NULL, 1);
 
+  if (NULL != record && -1 == Vframe.set.record (frame, record)) {
+    fprintf (stderr, "%s: can not record\n", record);
+    __deinit_vwm__ (&this);
+    return 1;
+  }
+
   char *largv[] = {"bash", NULL};
   frame = Vwin.get.frame_at (win, 1);
   Vframe.set.argv (frame, 1, largv);
@@ -0,0 +1,516 @@
+/* Replays terminal output through the frame emulator and reports how fast
+ * it goes. Each workload is run in two modes: "parse", through a headless
+ * frame whose render is dropped, and "render", through a frame of a window
+ * whose output goes to a sink, with a full window draw after every read.
+ *
+ * The built in workloads are generated streams, that look like what the
+ * named programs write. Files that are given as arguments, as the ones
+ * recorded with script(1) or with Vframe.set.record, are replayed as
+ * workloads of their own; a saved sequence trace (see Vwm.save_sequences)
+ * gives one for each of its frames.
+ *
+ * The results are printed one JSON object per line. Before the workloads,
+ * a frame is checked to keep its cursor on the screen through a resize; the
+ * bench fails if it doesn't.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/termios.h>
+
+#include <libv/libvwm.h>
+
+#define Vwm    this->self
+#define Vframe this->frame
+#define Vwin   this->win
+
+#define BENCH_ROWS   40
+#define BENCH_COLS   120
+#define BENCH_RUNS   3
+#define BENCH_CHUNK  BUFSIZE
+
+/* The library is linked statically with --wrap, so its calls land here. */
+void *__real_malloc (size_t);
+void *__real_calloc (size_t, size_t);
+void *__real_realloc (void *, size_t);
+
+static long num_allocs = 0;
+
+void *__wrap_malloc (size_t size) {
+  num_allocs++;
+  return __real_malloc (size);
+}
+
+void *__wrap_calloc (size_t nmemb, size_t size) {
+  num_allocs++;
+  return __real_calloc (nmemb, size);
+}
+
+void *__wrap_realloc (void *ptr, size_t size) {
+  num_allocs++;
+  return __real_realloc (ptr, size);
+}
+
+typedef struct stream_t {
+  char  *bytes;
+  size_t num_bytes;
+  size_t mem_size;
+} stream_t;
+
+static void stream_append (stream_t *s, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+
+static void stream_append (stream_t *s, const char *fmt, ...) {
+  char buf[1024];
+  va_list ap;
+  va_start (ap, fmt);
+  int len = vsnprintf (buf, sizeof (buf), fmt, ap);
+  va_end (ap);
+
+  if (len < 0) return;
+  if ((size_t) len >= sizeof (buf)) len = sizeof (buf) - 1;
+
+  if (s->num_bytes + len + 1 > s->mem_size) {
+    s->mem_size = (s->mem_size + len + 1) * 2;
+    s->bytes = realloc (s->bytes, s->mem_size);
+  }
+
+  memcpy (s->bytes + s->num_bytes, buf, len);
+  s->num_bytes += len;
+}
+
+static unsigned int seed = 1;
+
+static unsigned int rnd (unsigned int max) {
+  seed = seed * 1103515245 + 12345;
+  return ((seed >> 16) & 0x7fff) % max;
+}
+
+static const char *words[] = {
+  "request", "worker", "connection", "timeout", "buffer", "session",
+  "cache", "client", "server", "handler", "queue", "stream", "frame"
+};
+
+#define NUM_WORDS (sizeof (words) / sizeof (words[0]))
+
+/* a daemon log */
+static void gen_ascii (stream_t *s, size_t size) {
+  int n = 0;
+  while (s->num_bytes < size) {
+    stream_append (s, "2024-03-%02d %02d:%02d:%02d.%03d INFO  [%s-%d] %s %d %s in %d ms\r\n",
+        1 + rnd (28), rnd (24), rnd (60), rnd (60), rnd (1000),
+        words[rnd (NUM_WORDS)], rnd (16), words[rnd (NUM_WORDS)], n++,
+        words[rnd (NUM_WORDS)], rnd (5000));
+  }
+}
+
+/* text in a few scripts */
+static void gen_utf8 (stream_t *s, size_t size) {
+  static const char *texts[] = {
+    "Καλημέρα κόσμε, η γρήγορη καφέ αλεπού",
+    "Съешь же ещё этих мягких французских булок",
+    "いろはにほへと ちりぬるを わかよたれそ",
+    "中文字符的测试行，包含标点符号。",
+    "façade naïve coöperate résumé — “quotes” …",
+    "plain ascii between the others"
+  };
+
+  while (s->num_bytes < size) {
+    int num = 1 + rnd (3);
+    for (int i = 0; i < num; i++)
+      stream_append (s, "%s ", texts[rnd (sizeof (texts) / sizeof (texts[0]))]);
+    stream_append (s, "\r\n");
+  }
+}
+
+/* gcc diagnostics with colors */
+static void gen_sgr (stream_t *s, size_t size) {
+  while (s->num_bytes < size) {
+    int line = 1 + rnd (900), col = 1 + rnd (70);
+    int is_error = rnd (3) == 0;
+
+    stream_append (s, "\033[01m\033[Ksrc/%s.c:%d:%d:\033[m\033[K \033[01;%dm\033[K%s:\033[m\033[K "
+        "unused variable \xe2\x80\x98\033[01m\033[K%s\033[m\033[K\xe2\x80\x99 "
+        "[\033[01;%dm\033[K-Wunused-variable\033[m\033[K]\r\n",
+        words[rnd (NUM_WORDS)], line, col, (is_error ? 31 : 35),
+        (is_error ? "error" : "warning"), words[rnd (NUM_WORDS)], (is_error ? 31 : 35));
+
+    stream_append (s, "  %4d |   int \033[01;35m\033[K%s\033[m\033[K = %d;\r\n",
+        line, words[rnd (NUM_WORDS)], rnd (100));
+
+    stream_append (s, "       |       \033[01;35m\033[K^~~~~~\033[m\033[K\r\n");
+  }
+}
+
+/* screens that are drawn all over, as vi and htop do */
+static void gen_fullscreen (stream_t *s, size_t size) {
+  while (s->num_bytes < size) {
+    stream_append (s, "\033[?25l\033[H\033[2J");
+
+    for (int row = 1; row <= BENCH_ROWS; row++) {
+      stream_append (s, "\033[%d;1H", row);
+
+      if (row <= 4) {
+        int used = rnd (40);
+        stream_append (s, "  %d  \033[1m[\033[0;32m", row);
+        for (int i = 0; i < used; i++) stream_append (s, "|");
+        stream_append (s, "\033[31m");
+        for (int i = used; i < 40; i++) stream_append (s, (i < used + 5 ? "|" : " "));
+        stream_append (s, "\033[0;1m%5.1f%%]\033[0m\033[K", rnd (1000) / 10.0);
+      } else if (row == BENCH_ROWS) {
+        stream_append (s, "\033[7m\"%s.c\" %d lines --%d%%--\033[27m\033[K",
+            words[rnd (NUM_WORDS)], rnd (2000), rnd (100));
+      } else {
+        stream_append (s, "\033[33m%6d \033[0m%s\033[36m(%s)\033[0m { \033[1mreturn\033[0m %s; }\033[K",
+            rnd (99999), words[rnd (NUM_WORDS)], words[rnd (NUM_WORDS)], words[rnd (NUM_WORDS)]);
+      }
+    }
+
+    stream_append (s, "\033[%d;%dH\033[?25h", 1 + rnd (BENCH_ROWS), 1 + rnd (BENCH_COLS));
+  }
+}
+
+/* output that scrolls inside a region, with lines inserted and deleted */
+static void gen_scroll (stream_t *s, size_t size) {
+  while (s->num_bytes < size) {
+    int top = 2 + rnd (5), bottom = BENCH_ROWS - 1 - rnd (5);
+    stream_append (s, "\033[%d;%dr\033[%d;1H", top, bottom, bottom);
+
+    for (int i = 0; i < 32; i++) {
+      switch (rnd (6)) {
+        case 0:
+          stream_append (s, "\033[%d;1H\033M%s %d", top, words[rnd (NUM_WORDS)], i);
+          break;
+
+        case 1:
+          stream_append (s, "\033[%d;1H\033[%dL", top + rnd (bottom - top), 1 + rnd (3));
+          break;
+
+        case 2:
+          stream_append (s, "\033[%d;1H\033[%dM", top + rnd (bottom - top), 1 + rnd (3));
+          break;
+
+        default:
+          stream_append (s, "\033[%d;1H\r\n%s %s %d\033[K", bottom,
+              words[rnd (NUM_WORDS)], words[rnd (NUM_WORDS)], i);
+      }
+    }
+
+    stream_append (s, "\033[r");
+  }
+}
+
+typedef struct workload_t {
+  const char *name;
+  void (*gen) (stream_t *, size_t);
+} workload_t;
+
+static workload_t workloads[] = {
+  {"ascii", gen_ascii},
+  {"utf8", gen_utf8},
+  {"sgr", gen_sgr},
+  {"fullscreen", gen_fullscreen},
+  {"scroll", gen_scroll},
+};
+
+static size_t sunk = 0;
+
+static void sink_cb (vwm_t *this, char *bytes, size_t len) {
+  (void) this; (void) bytes;
+  sunk += len;
+}
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void feed (vwm_t *this, vwm_frame *frame, vwm_win *win, stream_t *s) {
+  size_t off = 0;
+  while (off < s->num_bytes) {
+    size_t len = s->num_bytes - off;
+    if (len > BENCH_CHUNK) len = BENCH_CHUNK;
+
+    Vframe.process_output (frame, s->bytes + off, (int) len);
+
+    if (win)
+      Vwin.draw (win);
+
+    off += len;
+  }
+}
+
+static void run (vwm_t *this, const char *name, stream_t *s, int render) {
+  double best = 0;
+  long allocs = 0;
+
+  for (int i = 0; i < BENCH_RUNS; i++) {
+    vwm_win *win = NULL;
+    vwm_frame *frame;
+
+    if (render) {
+      win = Vwm.new.win (this, "bench", WinOpts (
+          .num_rows = BENCH_ROWS,
+          .num_cols = BENCH_COLS,
+          .num_frames = 1,
+          .max_frames = 1));
+      frame = Vwin.get.frame_at (win, 0);
+    } else
+      frame = Vwm.new.frame (this, FrameOpts (
+          .num_rows = BENCH_ROWS,
+          .num_cols = BENCH_COLS));
+
+    long start_allocs = num_allocs;
+    double start = now ();
+
+    feed (this, frame, win, s);
+
+    double t = now () - start;
+    allocs = num_allocs - start_allocs;
+
+    if (0 == i || t < best)
+      best = t;
+
+    if (render)
+      Vwm.release_win (this, win);
+    else
+      Vwm.release_frame (this, frame);
+  }
+
+  double mb = s->num_bytes / (1024.0 * 1024.0);
+
+  fprintf (stdout,
+      "{\"workload\": \"%s\", \"mode\": \"%s\", \"bytes\": %zu, \"seconds\": %.6f, "
+      "\"mb_s\": %.2f, \"ns_byte\": %.2f, \"allocs_mb\": %.2f}\n",
+      name, (render ? "render" : "parse"), s->num_bytes, best,
+      mb / best, best * 1e9 / s->num_bytes, allocs / mb);
+  fflush (stdout);
+}
+
+static int read_file (const char *fname, stream_t *s) {
+  FILE *fp = fopen (fname, "r");
+  if (NULL == fp) return -1;
+
+  struct stat st;
+  if (-1 == fstat (fileno (fp), &st) || 0 == st.st_size) {
+    fclose (fp);
+    return -1;
+  }
+
+  s->bytes = malloc (st.st_size);
+  s->num_bytes = fread (s->bytes, 1, st.st_size, fp);
+  s->mem_size = st.st_size;
+  fclose (fp);
+  return 0;
+}
+
+static void stream_append_bytes (stream_t *s, const char *bytes, size_t len) {
+  if (s->num_bytes + len > s->mem_size) {
+    s->mem_size = (s->mem_size + len) * 2;
+    s->bytes = realloc (s->bytes, s->mem_size);
+  }
+
+  memcpy (s->bytes + s->num_bytes, bytes, len);
+  s->num_bytes += len;
+}
+
+/* Returns -1 when the file is not a recording; the output in it is then
+ * replayed as it was read, without the records. */
+static int run_recording (vwm_t *this, const char *name, stream_t *file) {
+  vwm_rec_header hdr;
+  if (file->num_bytes < sizeof (hdr)) return -1;
+
+  memcpy (&hdr, file->bytes, sizeof (hdr));
+  if (0 != memcmp (hdr.magic, VWM_REC_MAGIC, sizeof (VWM_REC_MAGIC)))
+    return -1;
+
+  if (hdr.version != VWM_REC_VERSION || hdr.byte_order != VWM_REC_BYTEORDER) {
+    fprintf (stderr, "%s: a recording of another version or machine\n", name);
+    return 0;
+  }
+
+  stream_t s = {NULL, 0, 0};
+  size_t off = sizeof (hdr);
+
+  while (off + sizeof (vwm_rec_record) <= file->num_bytes) {
+    vwm_rec_record rec;
+    memcpy (&rec, file->bytes + off, sizeof (rec));
+    off += sizeof (rec);
+    if (off + rec.len > file->num_bytes) break;
+
+    stream_append_bytes (&s, file->bytes + off, rec.len);
+    off += rec.len;
+  }
+
+  if (s.num_bytes) {
+    run (this, name, &s, 0);
+    run (this, name, &s, 1);
+  }
+
+  free (s.bytes);
+  return 0;
+}
+
+/* Returns -1 when the file is not a sequence trace. */
+static int run_sequences (vwm_t *this, const char *name, stream_t *file) {
+  vwm_seq_header hdr;
+  if (file->num_bytes < sizeof (hdr)) return -1;
+
+  memcpy (&hdr, file->bytes, sizeof (hdr));
+  if (0 != memcmp (hdr.magic, VWM_SEQ_MAGIC, sizeof (VWM_SEQ_MAGIC)))
+    return -1;
+
+  if (hdr.version != VWM_SEQ_VERSION || hdr.byte_order != VWM_SEQ_BYTEORDER) {
+    fprintf (stderr, "%s: a sequence trace of another version or machine\n", name);
+    return 0;
+  }
+
+  unsigned int last_id = 0;
+
+  for (;;) {
+    unsigned int id = 0;
+    stream_t s = {NULL, 0, 0};
+    size_t off = sizeof (hdr);
+
+    /* the chunks of the next frame, in the order they were read */
+    for (unsigned int i = 0; i < hdr.num_records; i++) {
+      vwm_seq_record rec;
+      if (off + sizeof (rec) > file->num_bytes) break;
+
+      memcpy (&rec, file->bytes + off, sizeof (rec));
+      off += sizeof (rec);
+      if (off + rec.len > file->num_bytes) break;
+
+      if (rec.frame_id > last_id && (0 == id || rec.frame_id < id)) {
+        id = rec.frame_id;
+        s.num_bytes = 0;
+      }
+
+      if (rec.frame_id == id)
+        stream_append_bytes (&s, file->bytes + off, rec.len);
+
+      off += rec.len;
+    }
+
+    if (0 == id) break;
+
+    last_id = id;
+
+    if (s.num_bytes) {
+      char fname[256];
+      snprintf (fname, sizeof (fname), "%s#%u", name, id);
+      run (this, fname, &s, 0);
+      run (this, fname, &s, 1);
+    }
+
+    free (s.bytes);
+  }
+
+  return 0;
+}
+
+/* A full frame with the cursor near the top, as vi and less leave it, is
+ * made smaller, so the lines below the cursor don't fit; the cursor has to
+ * stay on the screen, as the next byte is written at it. Returns -1 if not. */
+static int check_resize (vwm_t *this) {
+  vwm_frame *frame = Vwm.new.frame (this, FrameOpts (
+      .num_rows = 24,
+      .num_cols = 80));
+
+  stream_t s = {NULL, 0, 0};
+  for (int row = 1; row <= 24; row++)
+    stream_append (&s, "\033[%d;1Hline %d\033[K", row, row);
+
+  stream_append (&s, "\033[24;1H\0337\033[2;1H");
+  Vframe.process_output (frame, s.bytes, (int) s.num_bytes);
+
+  int retval = 0;
+  int sizes[] = {10, 1, 24};
+
+  for (size_t i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+    Vframe.on_resize (frame, sizes[i], 80);
+
+    int row = Vframe.get.row_pos (frame);
+    if (row < 1 || row > sizes[i]) {
+      fprintf (stderr, "resize to %d rows: the cursor is at row %d\n", sizes[i], row);
+      retval = -1;
+      break;
+    }
+
+    Vframe.process_output (frame, "x\0338y", 4);
+  }
+
+  Vwm.release_frame (this, frame);
+  free (s.bytes);
+  return retval;
+}
+
+int main (int argc, char **argv) {
+  size_t size = 4;
+  int opt;
+
+  while (-1 != (opt = getopt (argc, argv, "s:"))) {
+    switch (opt) {
+      case 's':
+        size = strtoul (optarg, NULL, 10);
+        break;
+
+      default:
+        fprintf (stderr, "usage: %s [-s MB per workload] [recorded stream...]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (0 == size) size = 1;
+
+  vwm_t *this = __init_vwm__ ();
+
+  Vwm.set.size (this, BENCH_ROWS, BENCH_COLS, 1);
+  Vwm.set.output_cb (this, sink_cb);
+
+  if (-1 == check_resize (this)) {
+    __deinit_vwm__ (&this);
+    return 1;
+  }
+
+  for (size_t i = 0; i < sizeof (workloads) / sizeof (workloads[0]); i++) {
+    stream_t s = {NULL, 0, 0};
+    seed = 1;
+    workloads[i].gen (&s, size * 1024 * 1024);
+
+    run (this, workloads[i].name, &s, 0);
+    run (this, workloads[i].name, &s, 1);
+    free (s.bytes);
+  }
+
+  for (int i = optind; i < argc; i++) {
+    stream_t s = {NULL, 0, 0};
+    if (-1 == read_file (argv[i], &s)) {
+      fprintf (stderr, "%s: can not read\n", argv[i]);
+      continue;
+    }
+
+    const char *name = strrchr (argv[i], '/');
+    name = (NULL == name ? argv[i] : name + 1);
+
+    if (0 == run_sequences (this, name, &s) || 0 == run_recording (this, name, &s)) {
+      free (s.bytes);
+      continue;
+    }
+
+    run (this, name, &s, 0);
+    run (this, name, &s, 1);
+    free (s.bytes);
+  }
+
+  __deinit_vwm__ (&this);
+  return 0;
+}
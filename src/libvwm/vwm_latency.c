@@ -0,0 +1,340 @@
+/* Measures the time from a keystroke to its echo on the terminal, while
+ * other frames flood output.
+ *
+ * The harness owns the outer terminal, as the master side of a pty pair.
+ * By default it runs the window manager on the other side, with a window
+ * of one frame that echoes its input and a few frames that flood. It then
+ * types keys one at a time and waits for each to appear in the output.
+ *
+ * When a command is given after "--", it is run on the outer terminal
+ * instead, so that other front ends, as vtach sessions, can be measured
+ * the same way. The harness is exported in the VWM_LATENCY environment
+ * variable, so the command can start the same programs in its frames:
+ *
+ *   vwm_latency -- vtach -s /tmp/lat.sock \
+ *     sh -c '"$VWM_LATENCY" --flood & exec "$VWM_LATENCY" --echo'
+ *
+ * The result is printed as one JSON object.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <pty.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/termios.h>
+
+#include <libv/libvwm.h>
+
+#define Vwm    this->self
+#define Vframe this->frame
+#define Vwin   this->win
+#define Vterm  this->term
+
+#define LATENCY_ROWS      40
+#define LATENCY_COLS      120
+#define LATENCY_TIMEOUT   2000
+#define LATENCY_WARMUP    10000
+#define LATENCY_QUIT_KEY  '\003'
+
+/* the keys that are typed; the flood and the window manager never write them */
+static const char markers[] = "QVWYZ";
+
+static const char usage[] =
+  "vwm_latency [options] [-- command [command arguments]]\n"
+  "\n"
+  "Options:\n"
+  "    -n keys       the number of keys to type (default 500)\n"
+  "    -f frames     the number of frames that flood output (default 2)\n"
+  "    -i ms         the interval between the keys (default 5)\n"
+  "    --echo        run as the program that echoes its input\n"
+  "    --flood       run as the program that floods its output\n";
+
+static double now_us (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int echo_main (void) {
+  struct termios t;
+  if (0 == tcgetattr (STDIN_FILENO, &t)) {
+    cfmakeraw (&t);
+    tcsetattr (STDIN_FILENO, TCSANOW, &t);
+  }
+
+  char buf[256];
+  for (;;) {
+    ssize_t n = read (STDIN_FILENO, buf, sizeof (buf));
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      return 0;
+    }
+
+    if (NULL != memchr (buf, LATENCY_QUIT_KEY, n))
+      return 0;
+
+    if (write (STDOUT_FILENO, buf, n) < 0)
+      return 1;
+  }
+}
+
+static int flood_main (void) {
+  static const char *words[] = {
+    "request", "worker", "connection", "timeout", "buffer", "session",
+    "cache", "client", "server", "handler", "queue", "stream", "frame"
+  };
+
+  unsigned int n = 0;
+  char line[256];
+
+  for (;;) {
+    int len = snprintf (line, sizeof (line), "\033[3%dm%8u\033[m %s %s %s done in %u ms\r\n",
+        1 + n % 6, n, words[n % 13], words[(n / 13) % 13], words[(n / 7) % 13], (n * 37) % 5000);
+    n++;
+
+    if (write (STDOUT_FILENO, line, len) < 0)
+      return 0;
+  }
+}
+
+static int vwm_child (const char *self, int num_flood) {
+  vwm_t *this = __init_vwm__ ();
+
+  vwm_term *term = Vwm.get.term (this);
+  Vterm.raw_mode (term);
+
+  int rows, cols;
+  Vterm.init_size (term, &rows, &cols);
+
+  Vwm.set.size (this, rows, cols, 1);
+
+  vwm_win *win = Vwm.new.win (this, "latency", WinOpts (
+    .num_rows = rows,
+    .num_cols = cols,
+    .num_frames = 1 + num_flood,
+    .max_frames = 1 + num_flood));
+
+  char *echo_argv[] = {(char *) self, "--echo", NULL};
+  char *flood_argv[] = {(char *) self, "--flood", NULL};
+
+  Vframe.set.argv (Vwin.get.frame_at (win, 0), 2, echo_argv);
+  for (int i = 1; i <= num_flood; i++)
+    Vframe.set.argv (Vwin.get.frame_at (win, i), 2, flood_argv);
+
+  Vterm.screen.save (term);
+  Vterm.screen.clear (term);
+
+  int retval = Vwm.main (this);
+
+  Vterm.screen.restore (term);
+
+  __deinit_vwm__ (&this);
+  return retval;
+}
+
+typedef struct outer_t {
+  int    fd;
+  size_t num_bytes;
+} outer_t;
+
+/* reads the outer terminal until the marker shows up, or until the time is up */
+static int wait_for (outer_t *o, char marker, double timeout_us) {
+  char buf[65536];
+  double end = now_us () + timeout_us;
+
+  for (;;) {
+    double left = end - now_us ();
+    if (left <= 0) return -1;
+
+    struct pollfd pfd = {.fd = o->fd, .events = POLLIN};
+    int r = poll (&pfd, 1, (int) (left / 1000) + 1);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+
+    if (0 == r) continue;
+
+    ssize_t n = read (o->fd, buf, sizeof (buf));
+    if (n <= 0) {
+      if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        if (pfd.revents & POLLHUP) return -1;
+        continue;
+      }
+
+      return -1;
+    }
+
+    o->num_bytes += n;
+
+    if (marker && NULL != memchr (buf, marker, n))
+      return 0;
+  }
+}
+
+static int cmp_double (const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static double percentile (double *v, int n, double q) {
+  return v[(int) (q * (n - 1))];
+}
+
+int main (int argc, char **argv) {
+  int num_keys = 500, num_flood = 2, interval = 5;
+  char **command = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (0 == strcmp (argv[i], "--echo"))
+      return echo_main ();
+
+    if (0 == strcmp (argv[i], "--flood"))
+      return flood_main ();
+
+    if (0 == strcmp (argv[i], "--")) {
+      if (i + 1 < argc) command = argv + i + 1;
+      break;
+    }
+
+    if (i + 1 < argc) {
+      if (0 == strcmp (argv[i], "-n")) { num_keys  = atoi (argv[++i]); continue; }
+      if (0 == strcmp (argv[i], "-f")) { num_flood = atoi (argv[++i]); continue; }
+      if (0 == strcmp (argv[i], "-i")) { interval  = atoi (argv[++i]); continue; }
+    }
+
+    fprintf (stderr, "%s", usage);
+    return 1;
+  }
+
+  if (num_keys <= 0) num_keys = 1;
+  if (num_flood < 0) num_flood = 0;
+  if (interval < 0) interval = 0;
+
+  char self[4096];
+  ssize_t len = readlink ("/proc/self/exe", self, sizeof (self) - 1);
+  if (len <= 0) {
+    fprintf (stderr, "can not find the path of the harness\n");
+    return 1;
+  }
+
+  self[len] = '\0';
+  setenv ("VWM_LATENCY", self, 1);
+
+  struct termios t;
+  memset (&t, 0, sizeof (t));
+  cfmakeraw (&t);
+
+  struct winsize ws = {.ws_row = LATENCY_ROWS, .ws_col = LATENCY_COLS};
+
+  outer_t o = {.fd = -1, .num_bytes = 0};
+
+  pid_t pid = forkpty (&o.fd, NULL, &t, &ws);
+  if (-1 == pid) {
+    fprintf (stderr, "forkpty(): %s\n", strerror (errno));
+    return 1;
+  }
+
+  if (0 == pid) {
+    if (NULL != command) {
+      execvp (command[0], command);
+      fprintf (stderr, "%s: %s\n", command[0], strerror (errno));
+      _exit (127);
+    }
+
+    _exit (vwm_child (self, num_flood));
+  }
+
+  fcntl (o.fd, F_SETFL, fcntl (o.fd, F_GETFL) | O_NONBLOCK);
+
+  int retval = 1;
+  double *lat = malloc (sizeof (double) * num_keys);
+  int num_lost = 0, num_lat = 0, k = 0;
+
+  /* the first echo means that the echo program is ready */
+  double end = now_us () + LATENCY_WARMUP * 1000.0;
+  for (;;) {
+    char c = markers[k++ % (sizeof (markers) - 1)];
+    if (write (o.fd, &c, 1) < 0) goto theend;
+    if (0 == wait_for (&o, c, 200000)) break;
+
+    if (pid == waitpid (pid, NULL, WNOHANG)) {
+      fprintf (stderr, "%s: exited before the first echo\n", (NULL == command ? "vwm" : command[0]));
+      goto done;
+    }
+
+    if (now_us () > end) {
+      fprintf (stderr, "no echo after %d ms\n", LATENCY_WARMUP);
+      goto theend;
+    }
+  }
+
+  wait_for (&o, 0, 200000);
+
+  o.num_bytes = 0;
+  double start = now_us ();
+
+  for (int i = 0; i < num_keys; i++) {
+    char c = markers[k++ % (sizeof (markers) - 1)];
+
+    double t0 = now_us ();
+    if (write (o.fd, &c, 1) < 0) goto theend;
+
+    if (0 == wait_for (&o, c, LATENCY_TIMEOUT * 1000.0))
+      lat[num_lat++] = now_us () - t0;
+    else
+      num_lost++;
+
+    if (interval)
+      wait_for (&o, 0, interval * 1000.0);
+  }
+
+  double elapsed = (now_us () - start) / 1e6;
+
+  if (0 == num_lat) {
+    fprintf (stderr, "all the keys were lost\n");
+    goto theend;
+  }
+
+  qsort (lat, num_lat, sizeof (double), cmp_double);
+
+  fprintf (stdout,
+      "{\"target\": \"%s\", \"keys\": %d, \"lost\": %d, \"flood_frames\": %d, "
+      "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f, "
+      "\"output_mb_s\": %.2f}\n",
+      (NULL == command ? "vwm" : command[0]), num_keys, num_lost,
+      (NULL == command ? num_flood : -1),
+      percentile (lat, num_lat, 0.50), percentile (lat, num_lat, 0.99),
+      percentile (lat, num_lat, 0.999), lat[num_lat - 1],
+      o.num_bytes / (1024.0 * 1024.0) / elapsed);
+
+  retval = 0;
+
+theend:
+  /* the echo program quits on this key, and most front ends with it */
+  if (-1 == write (o.fd, (char []) {LATENCY_QUIT_KEY}, 1))
+    fprintf (stderr, "can not write the quit key\n");
+
+  for (int i = 0; i < 20; i++) {
+    if (pid == waitpid (pid, NULL, WNOHANG)) goto done;
+    wait_for (&o, 0, 100000);
+  }
+
+  kill (pid, SIGKILL);
+  waitpid (pid, NULL, 0);
+
+done:
+  free (lat);
+  close (o.fd);
+  return retval;
+}
@@ -104,18 +104,22 @@ private int vwmed_process_frame (vwmed_t *this, vwm_win *win, vwm_frame *frame)
 
   Vwin.set.frame (win, frame);
 
+  vwm_t *vwm = $my(objects)[VWM_OBJECT];
+  int sigchld_fd = Vwm.get.sigchld_fd (vwm);
+
   int
-    maxfd = frame_fd,
+    maxfd = (frame_fd > sigchld_fd ? frame_fd : sigchld_fd),
     numready,
     output_len;
 
+  /* From here on, the child is waited for only after a SIGCHLD. */
+  if (0 is Vframe.check_pid (frame))
+    goto theend;
+
   for (;;) {
     FD_ZERO (&read_mask);
     FD_SET (STDIN_FILENO, &read_mask);
-
-    if (0 is Vframe.check_pid (frame))
-      goto theend;
-
+    FD_SET (sigchld_fd, &read_mask);
     FD_SET (frame_fd, &read_mask);
 
     if (0 >= (numready = select (maxfd + 1, &read_mask, NULL, NULL, tv))) {
@@ -129,6 +133,13 @@ private int vwmed_process_frame (vwmed_t *this, vwm_win *win, vwm_frame *frame)
       continue;
     }
 
+    if (FD_ISSET (sigchld_fd, &read_mask)) {
+      Vwm.handle_sigchld (vwm);
+
+      if (0 is Vframe.check_pid (frame))
+        goto theend;
+    }
+
     for (int i = 0; i < MAX_CHAR_LEN; i++) input_buf[i] = '\0';
 
     if (FD_ISSET (STDIN_FILENO, &read_mask)) {
@@ -170,6 +181,9 @@ private void vwmed_get_info (vwmed_t *this, vwm_t *vwm) {
   fprintf (fp, "Unimplemented fname: %s\n", vinfo->unimplemented_fname);
   fprintf (fp, "Num windows        : %d\n", vinfo->num_win);
   fprintf (fp, "Current window idx : %d\n", vinfo->cur_win_idx);
+  fprintf (fp, "Loop wakeups       : %lu\n", vinfo->counters.num_wakeups);
+  fprintf (fp, "Time in select     : %.3f ms\n", vinfo->counters.select_ns / 1e6);
+  fprintf (fp, "Input bytes        : %lu\n", vinfo->counters.stdin_bytes);
 
   for (int widx = 0; widx < vinfo->num_win; widx++) {
     vwin_info *w_info = vinfo->wins[widx];
@@ -180,6 +194,8 @@ private void vwmed_get_info (vwmed_t *this, vwm_t *vwm) {
     fprintf (fp, "Num frames         : %d\n", w_info->num_frames);
     fprintf (fp, "Visible frames     : %d\n", w_info->num_visible_frames);
     fprintf (fp, "Current frame idx  : %d\n", w_info->cur_frame_idx);
+    fprintf (fp, "Draws              : %lu\n", w_info->counters.num_draws);
+    fprintf (fp, "Cached draws       : %lu\n", w_info->counters.num_cached_draws);
 
     for (int fidx = 0; fidx < w_info->num_frames; fidx++) {
       vframe_info *f_info = w_info->frames[fidx];
@@ -192,6 +208,18 @@ private void vwmed_get_info (vwmed_t *this, vwm_t *vwm) {
       fprintf (fp, "It is current      : %s\n", (f_info->is_current ? "Yes" : "No"));
       fprintf (fp, "Frame is visible   : %s\n", (f_info->is_visible ? "Yes" : "No"));
       fprintf (fp, "Frame logfile      : %s\n", (f_info->logfile[0] isnot 0 ? f_info->logfile : "Hasn't been set"));
+
+      vframe_counters *c = &f_info->counters;
+      fprintf (fp, "Reads              : %lu\n", c->num_reads);
+      fprintf (fp, "Bytes read         : %lu\n", c->bytes_read);
+      fprintf (fp, "Bytes rendered     : %lu\n", c->bytes_rendered);
+      fprintf (fp, "Control characters : %lu\n", c->num_ctrl);
+      fprintf (fp, "Escape sequences   : %lu\n", c->num_esc);
+      fprintf (fp, "CSI sequences      : %lu (%lu SGR)\n", c->num_csi, c->num_sgr);
+      fprintf (fp, "Scrolled lines     : %lu\n", c->scrolled_lines);
+      fprintf (fp, "Full redraws       : %lu\n", c->num_redraws);
+      fprintf (fp, "Time parsing       : %.3f ms\n", c->parse_ns / 1e6);
+      fprintf (fp, "Time writing       : %.3f ms\n", c->write_ns / 1e6);
       fprintf (fp, "Frame argv         :");
 
       int arg = 0;
@@ -353,6 +381,50 @@ private int vwmed_process_rline (vwmed_t *this, rline_t *rl, vwm_t *vwm, vwm_win
     vwmed_get_info (this, vwm);
     retval = OK;
     goto theend;
+
+  } else if (Cstring.eq (com->bytes, "sequences")) {
+    string_t *enable = Rline.get.anytype_arg (rl, "enable");
+    string_t *fname = Rline.get.anytype_arg (rl, "file");
+
+    ifnot (NULL is enable) {
+      if (atoi (enable->bytes))
+        Vwm.set.debug.sequences (vwm, (NULL is fname ? NULL : fname->bytes));
+      else
+        Vwm.unset.debug.sequences (vwm);
+
+      retval = OK;
+      goto theend;
+    }
+
+    retval = Vwm.save_sequences (vwm, (NULL is fname ? NULL : fname->bytes));
+    goto theend;
+
+  } else if (Cstring.eq (com->bytes, "record")) {
+    string_t *enable = Rline.get.anytype_arg (rl, "enable");
+    string_t *fname = Rline.get.anytype_arg (rl, "file");
+
+    if (NULL isnot enable and 0 is atoi (enable->bytes)) {
+      Vframe.release_record (frame);
+      retval = OK;
+      goto theend;
+    }
+
+    retval = Vframe.set.record (frame, (NULL is fname ? NULL : fname->bytes));
+    goto theend;
+
+#ifdef VWM_TRACE
+  } else if (Cstring.eq (com->bytes, "trace")) {
+    string_t *enable = Rline.get.anytype_arg (rl, "enable");
+    ifnot (NULL is enable) {
+      Vwm.set.trace (vwm, atoi (enable->bytes));
+      retval = OK;
+      goto theend;
+    }
+
+    string_t *fname = Rline.get.anytype_arg (rl, "file");
+    retval = Vwm.trace_dump (vwm, (NULL is fname ? NULL : fname->bytes));
+    goto theend;
+#endif
   }
 
 theend:
@@ -763,6 +835,20 @@ private int vwmed_init_ved (vwmed_t *this) {
 
   Ed.append.rline_command ($my(ed), "info", 0, 0);
 
+  Ed.append.rline_command ($my(ed), "sequences", 0, 0);
+  Ed.append.command_arg   ($my(ed), "sequences", "--file=", 7);
+  Ed.append.command_arg   ($my(ed), "sequences", "--enable=", 9);
+
+  Ed.append.rline_command ($my(ed), "record", 0, 0);
+  Ed.append.command_arg   ($my(ed), "record", "--file=", 7);
+  Ed.append.command_arg   ($my(ed), "record", "--enable=", 9);
+
+#ifdef VWM_TRACE
+  Ed.append.rline_command ($my(ed), "trace", 0, 0);
+  Ed.append.command_arg   ($my(ed), "trace", "--file=", 7);
+  Ed.append.command_arg   ($my(ed), "trace", "--enable=", 9);
+#endif
+
   Ed.append.rline_command ($my(ed), "ed", 0, 0);
   if (Cstring.eq_n ("veda", Vwm.get.editor (vwm), 4)) {
     Ed.append.command_arg ($my(ed), "ed", "--exit", 6);